@@ -0,0 +1,244 @@
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTransform>
+
+#include "Assets.h"
+#include "Workers.h"
+
+#define ATLAS_BYTE_ORDER 0x01020304 // an atlas only makes sense on the kind of machine that wrote it
+
+// source png for each Assets::Sprite
+static const char *const sprite_names[Assets::SPRITE_COUNT] = { "player", "asteroid_big", "asteroid_med", "asteroid_small", "cruiser" };
+
+// where one frame's pixels are. they're QImage::Format_ARGB32_Premultiplied, as the machine lays them out
+struct AtlasFrame
+{
+	std::uint32_t width, height, bytes_per_line, unused;
+	std::uint64_t offset; // from the start of the file
+};
+
+// what an atlas file starts with. the frames' pixels follow
+struct AtlasHeader
+{
+	char magic[4];
+	std::uint32_t byte_order;
+	std::uint32_t version;
+	std::uint32_t frames, sprites;
+	std::uint32_t unused;
+	Assets::Stamps stamps; // of the pngs it was baked from
+	AtlasFrame frame[Assets::SPRITE_COUNT][ATLAS_FRAMES];
+};
+
+Assets::Assets(PackType t)
+	: type(t)
+{
+	// initialize asset pack variables
+	switch(type)
+	{
+		case PackType::SIMPLE:
+			path = "simple";
+			pen = QPen(Qt::black);
+			ship_health_pen = pen;
+			bullet_pen = pen;
+			pause_screen_text_pen = QPen(Qt::white);
+			health_brush = QBrush(Qt::black);
+			pause_screen_brush = QBrush(QColor(50, 50, 50, 200));
+			break;
+		case PackType::FANCY:
+			path = "fancy";
+			pen = QPen(Qt::white);
+			ship_health_pen = QPen(QColor(45, 245, 45));
+			bullet_pen = QPen(QColor(255, 255, 200));
+			pause_screen_text_pen = QPen(Qt::black);
+			health_brush = QBrush(Qt::white);
+			pause_screen_brush = QBrush(QColor(120, 120, 120, 100));
+			break;
+		default:
+			hcf("invalid pack type");
+			break;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const std::string directory = "assets/texture/" + path + "/";
+	const std::string cache = std::string(ATLAS_DIRECTORY) + "/" + path + ".atlas";
+
+	Stamps stamps;
+	for(int s = 0; s < SPRITE_COUNT; ++s)
+	{
+		const QFileInfo info(QString::fromStdString(directory + sprite_names[s] + ".png"));
+		stamps[s][0] = info.size();
+		stamps[s][1] = info.exists() ? info.lastModified().toMSecsSinceEpoch() : 0;
+	}
+
+	// warm start: straight out of the cache. cold start: bake it
+	const bool warm = map(cache, stamps);
+	int threads = 0;
+	if(!warm)
+	{
+		threads = bake(directory);
+		save(cache, stamps);
+	}
+
+	const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+	if(warm)
+		lprintf("assets: mapped %s in %.1f ms", cache.c_str(), took.count());
+	else
+		lprintf("assets: baked %s in %.1f ms on %d threads", cache.c_str(), took.count(), threads);
+}
+
+int Assets::todeg(float rad)
+{
+	while(rad < 0.0f)
+		rad += 3.1415926 * 2.0;
+	return (int)(rad * (180.0 / 3.1415926)) % 360;
+}
+
+const QImage &Assets::asteroid(AsteroidType type, float rad) const
+{
+	switch(type)
+	{
+		case AsteroidType::BIG:
+			return asteroid_big[Assets::todeg(rad)];
+		case AsteroidType::MED:
+			return asteroid_med[Assets::todeg(rad)];
+		case AsteroidType::SMALL:
+			return asteroid_small[Assets::todeg(rad)];
+		default: break;
+	}
+
+	hcf("invalid asteroid type");
+}
+
+QImage *Assets::sprite(int s)
+{
+	QImage *const sprites[SPRITE_COUNT] = { player, asteroid_big, asteroid_med, asteroid_small, ship };
+
+	return sprites[s];
+}
+
+// point the frames into the atlas file <name>, if it's there, intact and baked from the same pngs
+bool Assets::map(const std::string &name, const Stamps &stamps)
+{
+	atlas.setFileName(QString::fromStdString(name));
+	if(!atlas.open(QIODevice::ReadOnly))
+		return false;
+
+	const qint64 size = atlas.size();
+	const uchar *const data = size >= (qint64)sizeof(AtlasHeader) ? atlas.map(0, size) : NULL;
+	const auto fail = [this, data]()
+	{
+		if(data != NULL)
+			atlas.unmap((uchar*)data);
+		atlas.close();
+		return false;
+	};
+	if(data == NULL)
+		return fail();
+
+	// mapped memory is page aligned
+	const AtlasHeader &header = *(const AtlasHeader*)data;
+	if(memcmp(header.magic, "stba", 4) || header.byte_order != ATLAS_BYTE_ORDER || header.version != ATLAS_VERSION ||
+		header.frames != ATLAS_FRAMES || header.sprites != SPRITE_COUNT || memcmp(header.stamps, stamps, sizeof(Stamps)))
+		return fail();
+
+	for(int s = 0; s < SPRITE_COUNT; ++s)
+	{
+		for(int i = 0; i < ATLAS_FRAMES; ++i)
+		{
+			const AtlasFrame &frame = header.frame[s][i];
+			if(frame.bytes_per_line < frame.width * 4 || frame.offset % ATLAS_ALIGN != 0 ||
+				frame.offset + (std::uint64_t(frame.bytes_per_line) * frame.height) > (std::uint64_t)size)
+				return fail();
+		}
+	}
+
+	// read only, and not copied
+	for(int s = 0; s < SPRITE_COUNT; ++s)
+	{
+		for(int i = 0; i < ATLAS_FRAMES; ++i)
+		{
+			const AtlasFrame &frame = header.frame[s][i];
+			sprite(s)[i] = frame.width == 0 || frame.height == 0 ? QImage() :
+				QImage(data + frame.offset, frame.width, frame.height, frame.bytes_per_line, QImage::Format_ARGB32_Premultiplied);
+		}
+	}
+
+	return true;
+}
+
+// decode and rotate the pngs in <directory> on every core. returns how many that was
+int Assets::bake(const std::string &directory)
+{
+	Workers workers(std::thread::hardware_concurrency());
+
+	// QImage, unlike QPixmap, is fine off the gui thread
+	QImage source[SPRITE_COUNT];
+	workers.parallel_for("decode", SPRITE_COUNT, 1, [&](unsigned s)
+	{
+		source[s] = QImage(QString::fromStdString(directory + sprite_names[s] + ".png")).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	});
+
+	workers.parallel_for("rotate", SPRITE_COUNT * ATLAS_FRAMES, 8, [&](unsigned k)
+	{
+		const int s = k / ATLAS_FRAMES;
+		const int i = k % ATLAS_FRAMES;
+
+		sprite(s)[i] = source[s].transformed(QTransform().rotate(i), Qt::SmoothTransformation).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	});
+
+	return workers.count();
+}
+
+// write the frames out as the atlas file <name>. a cache that can't be written just means a slow start next time
+void Assets::save(const std::string &name, const Stamps &stamps)
+{
+	QDir().mkpath(ATLAS_DIRECTORY);
+	QSaveFile file(QString::fromStdString(name));
+	if(!file.open(QIODevice::WriteOnly))
+	{
+		lprintf("assets: can't write %s", name.c_str());
+		return;
+	}
+
+	std::unique_ptr<AtlasHeader> header(new AtlasHeader());
+	memcpy(header->magic, "stba", 4);
+	header->byte_order = ATLAS_BYTE_ORDER;
+	header->version = ATLAS_VERSION;
+	header->frames = ATLAS_FRAMES;
+	header->sprites = SPRITE_COUNT;
+	memcpy(header->stamps, stamps, sizeof(Stamps));
+
+	const auto align = [](std::uint64_t offset) { return (offset + ATLAS_ALIGN - 1) / ATLAS_ALIGN * ATLAS_ALIGN; };
+	std::uint64_t offset = align(sizeof(AtlasHeader));
+	for(int s = 0; s < SPRITE_COUNT; ++s)
+	{
+		for(int i = 0; i < ATLAS_FRAMES; ++i)
+		{
+			const QImage &image = sprite(s)[i];
+			header->frame[s][i] = { (std::uint32_t)image.width(), (std::uint32_t)image.height(), (std::uint32_t)image.bytesPerLine(), 0, offset };
+			offset = align(offset + (std::uint64_t(image.bytesPerLine()) * image.height()));
+		}
+	}
+
+	const char padding[ATLAS_ALIGN] = {};
+	file.write((const char*)header.get(), sizeof(AtlasHeader));
+	for(int s = 0; s < SPRITE_COUNT; ++s)
+	{
+		for(int i = 0; i < ATLAS_FRAMES; ++i)
+		{
+			const QImage &image = sprite(s)[i];
+			file.write(padding, header->frame[s][i].offset - file.pos());
+			file.write((const char*)image.constBits(), std::uint64_t(image.bytesPerLine()) * image.height());
+		}
+	}
+
+	if(!file.commit())
+		lprintf("assets: can't write %s", name.c_str());
+}
@@ -0,0 +1,71 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <string>
+
+#include <QFile>
+#include <QImage>
+#include <QPen>
+#include <QBrush>
+
+#include "GameState.h"
+
+#define ATLAS_DIRECTORY "assets/cache"
+#define ATLAS_VERSION 1 // bump whenever baking or the file layout changes
+#define ATLAS_FRAMES 360 // one rotation per degree
+#define ATLAS_ALIGN 16 // every frame's pixels start on a multiple of this in the file
+
+// textures and the pens and brushes that go with them.
+// every sprite comes pre-rotated to each whole degree. turning them is slow, so the first launch bakes the frames
+// across all cores and keeps them in an atlas file per pack under ATLAS_DIRECTORY. later launches map that file
+// and draw straight out of it, until a source png changes
+struct Assets
+{
+	enum class PackType
+	{
+		SIMPLE,
+		FANCY
+	};
+
+	enum Sprite
+	{
+		PLAYER,
+		ASTEROID_BIG,
+		ASTEROID_MED,
+		ASTEROID_SMALL,
+		SHIP,
+
+		SPRITE_COUNT
+	};
+
+	typedef std::int64_t Stamps[SPRITE_COUNT][2]; // size and modification time of each source png
+
+	Assets(PackType);
+	Assets(const Assets&) = delete;
+	void operator=(const Assets&) = delete;
+
+	static int todeg(float);
+	const QImage &asteroid(AsteroidType, float) const;
+
+	const PackType type;
+	std::string path;
+	QPen pen;
+	QPen ship_health_pen;
+	QPen bullet_pen;
+	QPen pause_screen_text_pen;
+	QBrush health_brush;
+	QBrush pause_screen_brush;
+
+private:
+	QImage *sprite(int);
+	bool map(const std::string&, const Stamps&);
+	int bake(const std::string&);
+	void save(const std::string&, const Stamps&);
+
+	QFile atlas; // mapped for as long as the frames below point into it, so it goes first
+
+public:
+	QImage player[ATLAS_FRAMES], asteroid_big[ATLAS_FRAMES], asteroid_med[ATLAS_FRAMES], asteroid_small[ATLAS_FRAMES], ship[ATLAS_FRAMES];
+};
+
+#endif // ASSETS_H
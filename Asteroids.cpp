@@ -1,18 +1,31 @@
+#include <algorithm>
+#include <cmath>
+
 #include "Asteroids.h"
 
-Asteroids::Asteroids(const std::string &addr, std::int32_t sec)
+Asteroids::Asteroids(net::udp &&socket, std::int32_t sec)
 	: delta(1.0f)
 	, my_id(0)
 	, score(0)
 	, repair(0)
 	, paused(false)
 	, win(false)
-	, time_last_datagram(time(NULL))
+	, time_last_datagram(milliseconds())
 	, random(time(NULL))
 	, udp_secret(sec)
-	, udp(addr, SERVER_PORT)
+	, udp(std::move(socket))
 	, last_step(0)
+	, input_step(0)
+	, input_due(0)
+	, lead(0.0f)
 	, time_last_step(std::chrono::high_resolution_clock::now())
+	, metrics_second(time(NULL))
+	, lockstep(false)
+	, workers(1)
+	, match_start(0)
+	, seed(0)
+	, checksums{}
+	, checked(0)
 {
 	if(!udp)
 		throw std::runtime_error("could not initialize udp socket");
@@ -22,28 +35,43 @@ void Asteroids::step()
 {
 	{ // timing related garbage
 		const std::chrono::duration<long long, std::ratio<1, 1'000'000'000>> diff = std::chrono::high_resolution_clock::now() - time_last_step;
-		const float normal_nano = 16666666.0f;
+		const float normal_nano = 1000000000.0f / BASE_TICK; // entity speeds are per BASE_TICK step
 		delta = diff.count() / normal_nano;
 		time_last_step = std::chrono::high_resolution_clock::now();
 	}
 
+	sounds.clear();
 	recv();
 
+	// roll the network counters over once a second
+	const int now = time(NULL);
+	if(now != metrics_second)
+	{
+		metrics = counting;
+		counting = NetMetrics();
+		metrics_second = now;
+	}
+
 	if(paused)
 		return;
 
-	// process players
-	for(Player &player : state.player_list)
-		player.step(false, Controls(), state, delta, random);
+	// in lockstep the entities move in play(), at the server's pace
+	if(!lockstep)
+	{
+		// process players
+		for(Player &player : state.player_list)
+			player.step(state, delta, random);
+		listen_for_shots();
 
-	// process boolets
-	Bullet::step(false, state, &particle_list, random);
+		// process boolets
+		Bullet::step(state, particle_list, sounds, random, delta);
 
-	// process asteroids
-	Asteroid::step(false, state, &particle_list, random, delta);
+		// process asteroids
+		Asteroid::step(state, particle_list, random, delta);
 
-	// process ships
-	Ship::step(false, state, &particle_list, delta, random);
+		// process ships
+		Ship::step(state, particle_list, delta, random);
+	}
 
 	// process particles
 	Particle::step(particle_list, delta);
@@ -53,42 +81,66 @@ void Asteroids::step()
 	// generate fireworks
 	if(win && random(18))
 	{
-		const float x = random(WORLD_LEFT, WORLD_RIGHT);
-		const float y = random(WORLD_TOP, WORLD_BOTTOM);
+		// around the player, the world may be much bigger than the screen
+		const Player *const player = focus();
+		const float center_x = player ? player->x : 0.0f;
+		const float center_y = player ? player->y : 0.0f;
+		const float x = random(std::max<float>(WORLD_LEFT, center_x - 500), std::min<float>(WORLD_RIGHT, center_x + 500));
+		const float y = random(std::max<float>(WORLD_TOP, center_y - 500), std::min<float>(WORLD_BOTTOM, center_y + 500));
 		Firework::create(firework_list, x, y, random);
 	}
 }
 
 void Asteroids::input(const Controls &controls)
 {
-	lmp::netbuf net_buffer;
+	lmp::netbuf net_buffer(&counting.out);
+	const std::int64_t now = milliseconds();
+
+	// one frame for each the server will play, going by its clock, so our frame rate doesn't over- or underfill
+	// its input queue. one a call until we know where its clock is. a couple at most to catch up, whatever
+	// was due further back has been played without us
+	int frames = 1;
+	if(clock.synced())
+	{
+		const std::int64_t due = std::floor(clock.server_step(now) * BASE_TICK / World::tick);
+		if(input_due != 0 && due <= input_due && input_due - due < BASE_TICK)
+			return;
+
+		frames = input_due != 0 && due > input_due ? std::min<std::int64_t>(due - input_due, 2) : 1;
+		input_due = due;
+	}
+
+	lmp::ClientInfo::Frame frame;
+	frame.x = controls.x;
+	frame.y = controls.y;
+	frame.fire = controls.fire;
+	frame.angle = controls.angle;
+
+	for(int i = 0; i < frames; ++i)
+		input_history.push_front(frame);
+	while(input_history.size() > INPUT_HISTORY)
+		input_history.pop_back();
 
 	lmp::ClientInfo info;
 	info.secret = udp_secret;
-	info.x = controls.x;
-	info.y = controls.y;
-	info.fire = controls.fire;
 	info.paused = controls.pause;
-	info.angle = controls.angle;
 	info.stepno = last_step;
+	input_step += frames;
+	info.input_step = input_step;
+	info.clock = now;
+	info.frame_count = input_history.size();
+	for(unsigned i = 0; i < input_history.size(); ++i)
+		info.frames[i] = input_history[i];
 
 	net_buffer.push(info);
 
 	udp.send(net_buffer.raw.data(), net_buffer.size);
+	counting.out.datagram(net_buffer.size);
 }
 
 void Asteroids::adjust_coords(const QWidget *window, float &x, float &y) const
 {
-	// find "me"
-	const Player *me = NULL;
-	for(const Player &p : state.player_list)
-	{
-		if(p.id == my_id)
-		{
-			me = &p;
-			break;
-		}
-	}
+	const Player *const me = focus();
 	if(me == NULL)
 		return;
 
@@ -108,158 +160,426 @@ const Player *Asteroids::me() const
 	return NULL;
 }
 
+// who the view follows: our own player, or whoever's first when spectating
+const Player *Asteroids::focus() const
+{
+	const Player *const player = me();
+	if(player != NULL || my_id != 0 || state.player_list.empty())
+		return player;
+
+	return &state.player_list.front();
+}
+
 bool Asteroids::timed_out() const
 {
-	return time(NULL) - time_last_datagram > SERVER_TIMEOUT;
+	return milliseconds() - time_last_datagram > SERVER_TIMEOUT;
 }
 
 void Asteroids::recv()
 {
-	lmp::netbuf buffer;
+	lmp::netbuf buffer(&counting.in);
 
 	while(lmp::netbuf::get(buffer, udp))
 	{
-#ifdef NETWORK_METRICS
-		{
-			static int bytes, last_second;
-			const int cursec = time(NULL);
-			if(cursec != last_second)
-			{
-				lprintf("%.3f kilobytes/sec", bytes / 1000.0);
-				last_second = cursec;
-				bytes = 0;
-			}
-			bytes += buffer.size;
-		}
-#endif // NETWORK_METRICS
-		time_last_datagram = time(NULL);
+		const std::int64_t now = milliseconds();
 
 		// pop ServerInfo
-		const lmp::ServerInfo *const info = buffer.pop<lmp::ServerInfo>();
-		if(info == NULL)
+		lmp::ServerInfo info;
+		if(!buffer.pop(info))
 		{
 			lprintf("no server info present in net buffer");
+			++counting.garbage;
+			buffer.reset();
 			continue;
 		}
 
-		integrate(*info);
+		// a keyframe more than a second behind isn't late, the stream started over (the server restarted, or the
+		// relay in between joined it again) and its steps count up from the start again
+		if(info.has_id && info.baseline == 0 && last_step > info.stepno + info.tick)
+		{
+			lprintf("the server's steps went back from %u to %u, starting over", last_step, info.stepno);
+			last_step = 0;
+			snapshots.fill(Snapshot());
+			clock.reset();
+		}
 
-		// pop Player lumps
-		const lmp::Player *player;
-		while((player = buffer.pop<lmp::Player>()))
+		// stale ones time the round trip as well as any, the estimate weeds out the slow ones
+		if(info.has_echo)
+			clock.sample(now, info.echo, info.hold, info.stepno, info.has_id ? info.tick : World::tick);
+
+		// stale or duplicate. they don't count as hearing from the server, or a stream stuck in the past would never time out
+		if(last_step != 0 && info.stepno <= last_step)
 		{
-			integrate(*player);
+			++counting.stale;
+			buffer.reset();
+			continue;
 		}
 
-		// pop asteroid lumps
-		const lmp::Asteroid *asteroid;
-		while((asteroid = buffer.pop<lmp::Asteroid>()))
+		time_last_datagram = now;
+
+		// lockstep, inputs instead of state
+		lmp::Lockstep inputs;
+		if(buffer.pop(inputs))
 		{
-			integrate(*asteroid);
+			play(info, inputs);
+			continue;
 		}
 
-		// pop ship lumps
-		const lmp::Ship *ship;
-		while((ship = buffer.pop<lmp::Ship>()))
+		const Snapshot *const base = baseline(info);
+		if(base == NULL)
 		{
-			integrate(*ship);
+			// lost track of the baseline, ask for everything again
+			lprintf("no baseline for step %u", info.stepno - info.baseline);
+			++counting.baseline_misses;
+			last_step = 0;
+			buffer.reset();
+			continue;
 		}
 
-		// pop remove lumps
-		const lmp::Remove *removed;
-		while((removed = buffer.pop<lmp::Remove>()))
+		// pop the entity changes
+		lmp::Delta delta;
+		if(!buffer.pop(delta))
 		{
-			integrate(*removed);
+			lprintf("no delta present in net buffer");
+			++counting.garbage;
+			buffer.reset();
+			continue;
+		}
+
+		Snapshot next;
+		next.stepno = info.stepno;
+		next.score = info.has_score ? info.score : base->score;
+		next.paused = info.paused == 1;
+
+		std::vector<const Record*> updated;
+		std::vector<Entity::Reference> removed, culled;
+		lmp::bitreader reader(delta.payload, delta.length);
+		if(!decode_delta(*base, reader, next, updated, removed, culled))
+		{
+			lprintf("garbage delta for step %u", info.stepno);
+			++counting.garbage;
+			last_step = 0;
+			continue;
 		}
+
+		++(info.baseline == 0 ? counting.full : counting.baseline_hits);
+
+		// the server's word for what we should have now
+		lmp::Checksum checksum;
+		if(buffer.pop(checksum) && checksum.value != next.checksum)
+		{
+			lprintf("snapshot %u decoded differently than the server encoded it", info.stepno);
+			++counting.desyncs;
+		}
+
+		integrate(info, next.score);
+
+		// by the time it got here the server was further along, catch up with it
+		lead = 0.0f;
+		if(clock.synced())
+			lead = std::max(0.0, std::min<double>((clock.server_step(time_last_datagram) - info.stepno) * BASE_TICK / World::tick, CLOCK_LEAD_MAX));
+
+		for(const Record *record : updated)
+			integrate(*record);
+
+		for(const Entity::Reference &ref : removed)
+			integrate(ref, false);
+
+		for(const Entity::Reference &ref : culled)
+			integrate(ref, true);
+
+		// without a baseline there are no removes, so drop whatever isn't in the snapshot
+		if(info.baseline == 0)
+			prune(next);
+
+		snapshots[next.stepno % SNAPSHOT_RING] = std::move(next);
 	}
 }
 
-void Asteroids::integrate(const lmp::ServerInfo &info)
+// lockstep: start the match over if the server did, then play whatever steps are next
+void Asteroids::play(const lmp::ServerInfo &info, const lmp::Lockstep &lump)
 {
-	last_step = info.stepno;
-	my_id = info.my_id;
-	score = info.score;
-	repair = info.repair;
-	paused = info.paused == 1;
-	win = info.win == 1;
-}
+	if(info.has_id)
+	{
+		my_id = info.my_id;
+		World::resize(info.world_width, info.world_height);
+		World::pace(info.tick);
+	}
+	else if(!lockstep)
+		return; // haven't heard what the world is yet
 
-void Asteroids::integrate(const lmp::Player &lump)
-{
-	for(Player &player : state.player_list)
+	bool same = lockstep && lump.start == match_start && lump.player_count == state.player_list.size();
+	for(unsigned i = 0; same && i < state.player_list.size(); ++i)
+		same = state.player_list[i].id == lump.roster[i];
+
+	if(!same)
 	{
-		if(player.id != lump.id)
+		state.restart(std::vector<std::int32_t>(lump.roster, lump.roster + lump.player_count), lump.start);
+		match = Match();
+		match_start = lump.start;
+		seed = lump.seed;
+		last_step = lump.start;
+		checksums = {};
+		checked = 0;
+		lockstep = true;
+	}
+
+	for(int i = 0; i < lump.tick_count; ++i)
+	{
+		const std::uint32_t step = lump.first + i;
+		if(step <= last_step)
 			continue;
+		if(step != last_step + 1)
+			break; // missed some, the server sends them again until they're acknowledged
 
-		player.x = lump.x;
-		player.y = lump.y;
-		player.xv = lump.xv;
-		player.yv = lump.yv;
-		player.rot = lump.rot;
-		player.shooting = lump.shooting;
-		player.health = lump.health;
+		play(lump.ticks[i]);
+		last_step = step;
 
-		return;
+		if(step % LOCKSTEP_CHECKSUM == 0)
+			checksums[(step / LOCKSTEP_CHECKSUM) % CHECKSUM_RING] = {step, state.checksum()};
+	}
+
+	// compare with the server's
+	const auto &mine = checksums[(lump.checksum_step / LOCKSTEP_CHECKSUM) % CHECKSUM_RING];
+	if(lump.checksum_step > checked && lump.checksum_step > match_start && mine.first == lump.checksum_step)
+	{
+		checked = lump.checksum_step;
+		if(mine.second != lump.checksum)
+		{
+			lprintf("lockstep desync at step %u", lump.checksum_step);
+			++counting.desyncs;
+		}
 	}
 
-	// not in the list
-	state.player_list.push_back(lump.id);
-	integrate(lump);
+	score = state.score;
+	paused = state.paused;
+	win = Match::won(state);
+
+	// what the server would have said about repairs
+	repair = 0;
+	if(const Player *const player = me())
+	{
+		repair = player->percent_repair;
+		for(const Player &p : state.player_list)
+			if(repair == 0 && &p != player && p.repairing_id == player->id)
+				repair = p.percent_repair;
+	}
 }
 
-void Asteroids::integrate(const lmp::Asteroid &lump)
+// one step of the match, and particles for the asteroids that broke up in it
+void Asteroids::play(const lmp::Lockstep::Tick &tick)
 {
-	for(Asteroid &aster : state.asteroid_list)
+	std::vector<Controls> controls(state.player_list.size());
+	for(unsigned i = 0; i < controls.size(); ++i)
+		controls[i] = lmp::Lockstep::controls(tick, i);
+
+	std::vector<Asteroid> before = state.asteroid_list;
+	match.step(state, controls, tick.bits & 1, seed, workers);
+
+	// the ones that went to sleep aren't gone
+	std::vector<std::int32_t> after;
+	for(const Asteroid &aster : state.asteroid_list)
+		after.push_back(aster.id);
+	for(const std::vector<Asteroid> &sector : state.dormant)
+		for(const Asteroid &aster : sector)
+			after.push_back(aster.id);
+	std::sort(after.begin(), after.end());
+
+	for(const Asteroid &aster : before)
 	{
-		if(lump.id != aster.id)
-			continue;
+		if(!std::binary_search(after.begin(), after.end(), aster.id))
+		{
+			Particle::create(particle_list, aster.x + (aster.w / 2), aster.y + (aster.h / 2), 40, random);
+			sounds.push_back({Sound::EXPLOSION, aster.x + (aster.w / 2), aster.y + (aster.h / 2)});
+		}
+	}
 
-		aster.x = lump.x;
-		aster.y = lump.y;
-		aster.xv = lump.xv;
-		aster.yv = lump.yv;
+	listen_for_shots();
+}
 
-		return;
+// players that fired just now
+void Asteroids::listen_for_shots()
+{
+	for(const Player &player : state.player_list)
+	{
+		if(player.timer_fire == PLAYER_TIMER_FIRE)
+			sounds.push_back({Sound::SHOT, player.x + (PLAYER_WIDTH / 2), player.y + (PLAYER_HEIGHT / 2)});
 	}
+}
+
+// the snapshot the server encoded this datagram against, NULL if it's gone
+const Snapshot *Asteroids::baseline(const lmp::ServerInfo &info) const
+{
+	static const Snapshot blank;
 
-	// not in the list
-	state.asteroid_list.push_back({lump.aster_type, random, NULL, lump.id});
-	integrate(lump);
+	if(info.baseline == 0)
+		return &blank;
+
+	const std::uint32_t step = info.stepno - info.baseline;
+	const Snapshot &snapshot = snapshots[step % SNAPSHOT_RING];
+	if(snapshot.stepno != step)
+		return NULL;
+
+	return &snapshot;
 }
 
-void Asteroids::integrate(const lmp::Ship &lump)
+void Asteroids::prune(const Snapshot &snapshot)
 {
-	// find it in the list
-	for(Ship &ship : state.ship_list)
+	std::vector<Entity::Reference> gone;
+
+	const auto missing = [&snapshot](Entity::Type kind, int id)
 	{
-		if(ship.id != lump.id)
-			continue;
+		Record key;
+		key.kind = kind;
+		key.id = id;
 
-		ship.x = lump.x;
-		ship.y = lump.y;
-		ship.xv = lump.xv;
-		ship.yv = lump.yv;
-		ship.health = lump.health;
+		return !std::binary_search(snapshot.records.begin(), snapshot.records.end(), key);
+	};
 
-		return;
+	for(const Player &p : state.player_list)
+		if(missing(Entity::Type::PLAYER, p.id))
+			gone.push_back({Entity::Type::PLAYER, p.id});
+	for(const Asteroid &a : state.asteroid_list)
+		if(missing(Entity::Type::ASTEROID, a.id))
+			gone.push_back({Entity::Type::ASTEROID, a.id});
+	for(const Ship &s : state.ship_list)
+		if(missing(Entity::Type::SHIP, s.id))
+			gone.push_back({Entity::Type::SHIP, s.id});
+
+	for(const Entity::Reference &ref : gone)
+		integrate(ref, true);
+}
+
+void Asteroids::integrate(const lmp::ServerInfo &info, std::int32_t new_score)
+{
+	last_step = info.stepno;
+	if(info.has_id)
+	{
+		my_id = info.my_id;
+		World::resize(info.world_width, info.world_height);
+		World::pace(info.tick);
 	}
+	score = new_score;
+	repair = info.repair;
+	paused = info.paused == 1;
+	win = info.win == 1;
+}
 
-	state.ship_list.push_back({random, lump.id});
-	integrate(lump);
-	if(!win)
-		announcements.push({"Protect the passenger cruiser!"});
+void Asteroids::integrate(const Record &record)
+{
+	switch(record.kind)
+	{
+		case Entity::Type::PLAYER:
+		{
+			Player *player = NULL;
+			for(Player &p : state.player_list)
+			{
+				if(p.id == record.id)
+				{
+					player = &p;
+					break;
+				}
+			}
+
+			if(player == NULL)
+			{
+				state.player_list.push_back(record.id);
+				player = &state.player_list.back();
+			}
+
+			player->x = Record::position(record.field[Record::X]);
+			player->y = Record::position(record.field[Record::Y]);
+			player->xv = Record::velocity(record.field[Record::XV]);
+			player->yv = Record::velocity(record.field[Record::YV]);
+			player->rot = Record::angle(record.field[Record::ROT]);
+			player->shooting = record.field[Record::FLAGS] == 1;
+			player->health = record.field[Record::HEALTH];
+
+			break;
+		}
+
+		case Entity::Type::ASTEROID:
+		{
+			Asteroid *aster = NULL;
+			for(Asteroid &a : state.asteroid_list)
+			{
+				if(a.id == record.id)
+				{
+					aster = &a;
+					break;
+				}
+			}
+
+			if(aster == NULL)
+			{
+				const AsteroidType type = (AsteroidType)record.field[Record::SUBTYPE];
+				if(type != AsteroidType::BIG && type != AsteroidType::MED && type != AsteroidType::SMALL)
+				{
+					lprintf("invalid asteroid type %d", record.field[Record::SUBTYPE]);
+					return;
+				}
+
+				state.asteroid_list.push_back({type, random, NULL, record.id});
+				aster = &state.asteroid_list.back();
+			}
+
+			aster->x = Record::position(record.field[Record::X]);
+			aster->y = Record::position(record.field[Record::Y]);
+			aster->xv = Record::velocity(record.field[Record::XV]);
+			aster->yv = Record::velocity(record.field[Record::YV]);
+			aster->move(lead);
+
+			break;
+		}
+
+		case Entity::Type::SHIP:
+		{
+			Ship *ship = NULL;
+			for(Ship &s : state.ship_list)
+			{
+				if(s.id == record.id)
+				{
+					ship = &s;
+					break;
+				}
+			}
+
+			if(ship == NULL)
+			{
+				state.ship_list.push_back({random, record.id});
+				ship = &state.ship_list.back();
+				if(!win)
+					announcements.push({"Protect the passenger cruiser!"});
+			}
+
+			ship->x = Record::position(record.field[Record::X]);
+			ship->y = Record::position(record.field[Record::Y]);
+			ship->xv = Record::velocity(record.field[Record::XV]);
+			ship->yv = Record::velocity(record.field[Record::YV]);
+			ship->health = record.field[Record::HEALTH];
+			if(ship->health > 0)
+				ship->move(lead);
+
+			break;
+		}
+
+		default:
+			lprintf("invalid record type %d", (int)record.kind);
+			break;
+	}
 }
 
-void Asteroids::integrate(const lmp::Remove &lump)
+// <culled> means it only went out of view, so no fanfare
+void Asteroids::integrate(const Entity::Reference &ref, bool culled)
 {
-	switch(lump.ref.type)
+	switch(ref.type)
 	{
 		case Entity::Type::PLAYER:
 		{
 			// find it in player list
 			for(auto it = state.player_list.begin(); it != state.player_list.end(); ++it)
 			{
-				if((*it).id == lump.ref.id)
+				if((*it).id == ref.id)
 				{
 					state.player_list.erase(it);
 					break;
@@ -274,11 +594,15 @@ void Asteroids::integrate(const lmp::Remove &lump)
 			// find it in the asteroid list
 			for(auto it = state.asteroid_list.begin(); it != state.asteroid_list.end(); ++it)
 			{
-				if((*it).id == lump.ref.id)
+				if((*it).id == ref.id)
 				{
 					const Asteroid &aster = *it;
 
-					Particle::create(particle_list, aster.x + (aster.w / 2), aster.y + (aster.h / 2), 40, random);
+					if(!culled)
+					{
+						Particle::create(particle_list, aster.x + (aster.w / 2), aster.y + (aster.h / 2), 40, random);
+						sounds.push_back({Sound::EXPLOSION, aster.x + (aster.w / 2), aster.y + (aster.h / 2)});
+					}
 					state.asteroid_list.erase(it);
 					break;
 				}
@@ -292,13 +616,18 @@ void Asteroids::integrate(const lmp::Remove &lump)
 			// find it in the ship list
 			for(auto it = state.ship_list.begin(); it != state.ship_list.end(); ++it)
 			{
-				if((*it).id == lump.ref.id)
+				if((*it).id == ref.id)
 				{
 					const Ship &ship = *it;
 
-					if((*it).health < 1)
+					if(culled)
+					{
+						// nothing to see here
+					}
+					else if((*it).health < 1)
 					{
 						Particle::create(particle_list, ship.x + (SHIP_WIDTH / 2), ship.y + (SHIP_HEIGHT / 2), 120, random);
+						sounds.push_back({Sound::BLAST, ship.x + (SHIP_WIDTH / 2), ship.y + (SHIP_HEIGHT / 2)});
 						if(!win)
 							announcements.push({"The passenger cruiser was destroyed\nand all 1 billion billion passengers were killed!"});
 					}
@@ -313,7 +642,7 @@ void Asteroids::integrate(const lmp::Remove &lump)
 		}
 
 		default:
-			hcf("invalide remove id %d", lump.ref.type);
+			hcf("invalide remove id %d", ref.type);
 			break;
 	}
 }
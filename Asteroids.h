@@ -1,7 +1,9 @@
 #ifndef ASTEROIDS_H
 #define ASTEROIDS_H
 
+#include <array>
 #include <chrono>
+#include <deque>
 #include <queue>
 
 #include <QWidget>
@@ -9,8 +11,32 @@
 #include "network.h"
 #include "Lump.h"
 #include "GameState.h"
+#include "Snapshot.h"
+#include "Simulation.h"
+#include "ClockSync.h"
 
-// #define NETWORK_METRICS
+#define SNAPSHOT_RING 64 // decoded snapshots kept around as possible delta baselines
+#define CHECKSUM_RING 8 // lockstep checksums kept around to compare with the server's
+
+// network counters, always kept
+struct NetMetrics
+{
+	NetMetrics()
+		: baseline_hits(0)
+		, baseline_misses(0)
+		, full(0)
+		, stale(0)
+		, garbage(0)
+		, desyncs(0)
+	{}
+
+	lmp::Traffic in, out;
+	unsigned baseline_hits, baseline_misses; // deltas against a snapshot we still had, or didn't
+	unsigned full; // datagrams that came without a baseline
+	unsigned stale; // out of order or duplicate datagrams
+	unsigned garbage; // datagrams that didn't parse
+	unsigned desyncs; // lockstep or snapshot checksums that didn't match the server's
+};
 
 struct Announcement
 {
@@ -26,11 +52,12 @@ struct Announcement
 class Asteroids
 {
 public:
-	Asteroids(const std::string&, std::int32_t);
+	Asteroids(net::udp&&, std::int32_t);
 	void step();
 	void input(const Controls&);
 	void adjust_coords(const QWidget*, float&, float&) const;
 	const Player *me() const;
+	const Player *focus() const;
 	bool timed_out() const;
 
 	std::queue<Announcement> announcements;
@@ -44,21 +71,43 @@ public:
 	unsigned repair;
 	bool paused;
 	bool win;
-	int time_last_datagram;
+	std::int64_t time_last_datagram; // milliseconds()
+	NetMetrics metrics; // over the last full second
+	ClockSync clock; // round trip and the server's step counter
+	std::vector<Sound> sounds; // set off during the last step()
 
 private:
 	mersenne random;
 	const std::int32_t udp_secret;
 	net::udp udp;
 	std::uint32_t last_step;
+	std::uint32_t input_step;
+	std::int64_t input_due; // input frames the server will have played by the latest ClientInfo, by its clock. 0 before we knew
+	float lead; // BASE_TICK steps the server is ahead of the snapshot being integrated
+	std::deque<lmp::ClientInfo::Frame> input_history; // newest first
+	std::array<Snapshot, SNAPSHOT_RING> snapshots; // indexed by stepno % SNAPSHOT_RING
 	std::chrono::time_point<std::chrono::high_resolution_clock> time_last_step;
+	NetMetrics counting; // for the current second
+	int metrics_second;
+
+	// lockstep mode, where the match runs here from the server's inputs
+	bool lockstep;
+	Match match;
+	Workers workers;
+	std::uint32_t match_start;
+	std::uint64_t seed;
+	std::array<std::pair<std::uint32_t, std::uint32_t>, CHECKSUM_RING> checksums; // (step, checksum), by step / LOCKSTEP_CHECKSUM
+	std::uint32_t checked; // latest server checksum compared
 
 	void recv();
-	void integrate(const lmp::ServerInfo&);
-	void integrate(const lmp::Player&);
-	void integrate(const lmp::Asteroid&);
-	void integrate(const lmp::Ship&);
-	void integrate(const lmp::Remove&);
+	const Snapshot *baseline(const lmp::ServerInfo&) const;
+	void prune(const Snapshot&);
+	void integrate(const lmp::ServerInfo&, std::int32_t);
+	void integrate(const Record&);
+	void integrate(const Entity::Reference&, bool);
+	void play(const lmp::ServerInfo&, const lmp::Lockstep&);
+	void play(const lmp::Lockstep::Tick&);
+	void listen_for_shots();
 };
 
 #endif // ASTEROIDS_H
@@ -0,0 +1,230 @@
+#include <algorithm>
+
+#include "Broadcast.h"
+
+// keyed hash of the address and the epoch.
+// bit 30 is always set so these never collide with the secrets handed out over tcp, bit 29 tells spectators apart
+std::int32_t join_cookie(std::uint64_t key, const net::udp_id &udpid, int epoch, bool spectator)
+{
+	std::uint64_t hash = 14695981039346656037ull ^ key;
+	const auto mix = [&hash](std::uint8_t byte)
+	{
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	};
+
+	const std::uint8_t *const addr = (const std::uint8_t*)&udpid.storage;
+	for(unsigned i = 0; i < udpid.len && i < sizeof(udpid.storage); ++i)
+		mix(addr[i]);
+	for(unsigned i = 0; i < sizeof(epoch); ++i)
+		mix(epoch >> (i * 8));
+
+	// finalize
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+
+	return (std::int32_t)((hash & 0x1fffffff) | 0x40000000 | (spectator ? 0x20000000 : 0));
+}
+
+// whether <secret> was handed out to <udpid> lately
+bool valid_cookie(std::uint64_t key, std::int32_t secret, const net::udp_id &udpid, bool spectator)
+{
+	const int epoch = time(NULL) / COOKIE_LIFETIME;
+
+	return secret == join_cookie(key, udpid, epoch, spectator) || secret == join_cookie(key, udpid, epoch - 1, spectator);
+}
+
+Broadcaster::Broadcaster()
+	: broadcast_seq(0)
+	, keyframe_seq(0)
+	, checksummed(0)
+	, buffer(&traffic)
+{}
+
+// NULL if there's no room
+Spectator *Broadcaster::join(std::int32_t secret, const net::udp_id &udpid)
+{
+	if(spectators.size() >= MAX_SPECTATORS)
+		return NULL;
+
+	spectators.push_back(Spectator(secret, udpid));
+	index[secret] = spectators.size() - 1;
+	lprintf("spectator joined, %u watching", (unsigned)spectators.size());
+
+	return &spectators.back();
+}
+
+// by the secret it was handed, NULL if there's no such spectator. it's looked up for every datagram that comes in,
+// from several threads at once as long as nobody joins or leaves meanwhile
+Spectator *Broadcaster::find(std::int32_t secret)
+{
+	const auto it = index.find(secret);
+
+	return it != index.end() ? &spectators[it->second] : NULL;
+}
+
+// <spectator> says it's up to step <stepno>
+void Broadcaster::heard(Spectator &spectator, std::uint32_t stepno)
+{
+	spectator.last_datagram_time = milliseconds();
+
+	const auto it = std::lower_bound(broadcasts.begin(), broadcasts.end(), stepno, [](const Broadcast &b, std::uint32_t step) { return b.sent.stepno < step; });
+	if(it == broadcasts.end() || it->sent.stepno != stepno)
+		return;
+
+	// to decode it, it had to have the one it was a delta against, and so on back
+	const std::uint32_t first = broadcast_seq - broadcasts.size() + 1;
+	for(std::uint32_t seq = broadcast_seq - (broadcasts.end() - it - 1); seq >= first && seq != 0; seq = broadcasts[seq - first].baseline)
+		spectator.ack(seq);
+}
+
+// one datagram for every spectator of <snapshot>, whatever the number of them. NULL if there's nothing new in it.
+// it's a delta against the recent broadcast the most of them are known to have. the ones that don't have it (new,
+// or lost too many) don't hold the rest back: they wait for the next keyframe, which is sent against nothing
+// whenever somebody needs one, but no more than once every SPECTATOR_KEYFRAME broadcasts
+const lmp::netbuf *Broadcaster::compile(const Snapshot &snapshot, bool win)
+{
+	static const Snapshot blank;
+
+	if(spectators.empty())
+		return NULL;
+
+	// how many spectators have each of the recent broadcasts, newest first
+	unsigned holders[SPECTATOR_BASELINES] = {};
+	for(const Spectator &spectator : spectators)
+	{
+		for(std::uint64_t holding = spectator.holding(broadcast_seq); holding != 0; holding &= holding - 1)
+		{
+			unsigned back = 0;
+			while(!(holding & (1ull << back)))
+				++back;
+			++holders[back];
+		}
+	}
+
+	// the one most of them have, the newest of those. that's all of them, unless some are new or lost track
+	const Snapshot *shared = NULL;
+	std::uint32_t shared_seq = 0;
+	unsigned most = 0;
+	for(unsigned back = 0; back < broadcasts.size(); ++back)
+	{
+		const Broadcast &candidate = broadcasts[broadcasts.size() - 1 - back];
+		if(snapshot.stepno - candidate.sent.stepno >= SPECTATOR_BASELINES)
+			break;
+
+		if(holders[back] > most)
+		{
+			shared = &candidate.sent;
+			shared_seq = broadcast_seq - back;
+			most = holders[back];
+		}
+	}
+	const bool lost = most < spectators.size();
+	const unsigned age = shared ? snapshot.stepno - shared->stepno : 0;
+	const bool has_baseline = shared != NULL && age > 0 && !(lost && broadcast_seq - keyframe_seq >= SPECTATOR_KEYFRAME);
+	const Snapshot &base = has_baseline ? *shared : blank;
+
+	traffic = lmp::Traffic();
+	buffer.reset();
+
+	lmp::ServerInfo info;
+	info.stepno = snapshot.stepno;
+	info.baseline = has_baseline ? age : 0;
+	info.has_id = !has_baseline;
+	info.my_id = 0;
+	info.world_width = World::width;
+	info.world_height = World::height;
+	info.tick = World::tick;
+	info.repair = 0;
+	info.has_repair = false;
+	info.score = snapshot.score;
+	info.has_score = !has_baseline || base.score != snapshot.score;
+	info.paused = snapshot.paused;
+	info.win = win;
+	buffer.push(info);
+
+	// the whole world, no culling and nothing to prioritize for
+	lmp::Delta delta;
+	DeltaStats delta_stats;
+	Snapshot sent;
+	sent.stepno = snapshot.stepno;
+	sent.score = snapshot.score;
+	sent.paused = snapshot.paused;
+
+	const bool checksum_due = snapshot.stepno - checksummed >= SNAPSHOT_CHECKSUM;
+	lmp::Checksum checksum;
+
+	std::array<std::uint8_t, MAX_DATAGRAM_SIZE> payload;
+	delta.payload = payload.data();
+	lmp::bitwriter writer(payload.data(), buffer.raw.size() - buffer.size - sizeof(lmp::Type) - sizeof(delta.length) -
+		(checksum_due ? sizeof(lmp::Type) + sizeof(checksum.value) : 0));
+	encode_delta(base, snapshot, snapshot, writer, sent, delta_stats);
+	delta.length = writer.bytes();
+	buffer.push(delta);
+
+	const bool info_present =
+		info.has_id ||
+		info.has_score ||
+		(info.paused == 1) != base.paused ||
+		info.win ||
+		delta_stats.changes() > 0;
+
+	if(!info_present)
+	{
+		++stats.suppressed;
+		return NULL;
+	}
+
+	if(checksum_due)
+	{
+		checksum.value = sent.checksum;
+		buffer.push(checksum);
+		checksummed = snapshot.stepno;
+	}
+
+	broadcasts.push_back({std::move(sent), has_baseline ? shared_seq : 0});
+	if(broadcasts.size() > SPECTATOR_BASELINES)
+		broadcasts.pop_front();
+	++broadcast_seq;
+	if(!has_baseline)
+		keyframe_seq = broadcast_seq;
+
+	traffic.datagram(buffer.size);
+	stats.traffic += traffic;
+	++stats.broadcasts;
+	stats.keyframes += !has_baseline;
+	stats.deferred += delta_stats.deferred;
+	stats.datagrams += spectators.size();
+
+	return &buffer;
+}
+
+// the stream starts over with steps that aren't newer than the ones broadcast so far (a relay's upstream restarted).
+// nothing from before is a baseline for what comes next, so everyone gets a keyframe
+void Broadcaster::restart()
+{
+	broadcasts.clear();
+	checksummed = 0;
+
+	for(Spectator &spectator : spectators)
+		spectator.held = 0;
+}
+
+// drop the spectators that haven't been heard from in a while
+void Broadcaster::check_timeout()
+{
+	const std::int64_t now = milliseconds();
+
+	const auto gone = std::remove_if(spectators.begin(), spectators.end(), [now](const Spectator &s) { return now - s.last_datagram_time > CLIENT_TIMEOUT; });
+	if(gone != spectators.end())
+	{
+		spectators.erase(gone, spectators.end());
+
+		index.clear();
+		for(unsigned i = 0; i < spectators.size(); ++i)
+			index[spectators[i].secret] = i;
+
+		lprintf("spectator timed out, %u watching", (unsigned)spectators.size());
+	}
+}
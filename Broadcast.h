@@ -0,0 +1,116 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "network.h"
+#include "Lump.h"
+#include "Snapshot.h"
+
+#define COOKIE_LIFETIME 30 // seconds a udp join cookie stays valid (it is accepted for up to two of these)
+#define MAX_SPECTATORS 512 // on top of MAX_PLAYERS
+#define SPECTATOR_BASELINES 64 // recent broadcasts kept as shared delta baselines, one bit each in Spectator::held. no older in steps either, it's the client's ring
+#define SPECTATOR_KEYFRAME 30 // broadcasts at least between keyframes held out for new or lost spectators
+
+// stateless udp join cookies, syn cookie style. see Server::handshake
+std::int32_t join_cookie(std::uint64_t, const net::udp_id&, int, bool);
+bool valid_cookie(std::uint64_t, std::int32_t, const net::udp_id&, bool);
+
+// what spectators will have decoded for one broadcast
+struct Broadcast
+{
+	Snapshot sent;
+	std::uint32_t baseline; // number of the broadcast it was a delta against, 0 for a keyframe
+};
+
+// watches without a player. what it acknowledges only decides which broadcast the next one is a delta against
+struct Spectator
+{
+	Spectator(std::int32_t sec, const net::udp_id &id)
+	: udpid(id)
+	, secret(sec)
+	, held(0)
+	, held_seq(0)
+	, last_datagram_time(milliseconds())
+	{}
+
+	// <held> shifted so bit 0 stands for broadcast <seq>, no older than SPECTATOR_BASELINES
+	std::uint64_t holding(std::uint32_t seq) const
+	{
+		const std::uint32_t shift = seq - held_seq;
+
+		return shift < SPECTATOR_BASELINES ? held << shift : 0;
+	}
+
+	// it decoded broadcast <seq>
+	void ack(std::uint32_t seq)
+	{
+		if(seq > held_seq)
+		{
+			held = holding(seq);
+			held_seq = seq;
+		}
+
+		if(held_seq - seq < SPECTATOR_BASELINES)
+			held |= 1ull << (held_seq - seq);
+	}
+
+	net::udp_id udpid;
+	std::int32_t secret;
+	std::uint64_t held; // bit n: it has broadcast number held_seq - n
+	std::uint32_t held_seq;
+	std::int64_t last_datagram_time; // milliseconds()
+};
+
+// one snapshot stream for any number of spectators.
+// each broadcast is encoded once and the same datagram goes to all of them, so what it costs to encode doesn't
+// depend on how many are watching. the server has one, and so does every relay
+class Broadcaster
+{
+public:
+	// since the caller last reset them
+	struct Stats
+	{
+		Stats()
+			: broadcasts(0)
+			, keyframes(0)
+			, suppressed(0)
+			, deferred(0)
+			, datagrams(0)
+		{}
+
+		unsigned broadcasts;
+		unsigned keyframes;
+		unsigned suppressed; // broadcasts not sent because there was nothing in them
+		unsigned deferred; // entity changes that didn't fit
+		unsigned long long datagrams; // broadcasts times the spectators they went to
+		lmp::Traffic traffic; // once per broadcast
+	};
+
+	Broadcaster();
+	Broadcaster(const Broadcaster&) = delete;
+	void operator=(const Broadcaster&) = delete;
+
+	Spectator *join(std::int32_t, const net::udp_id&);
+	Spectator *find(std::int32_t);
+	void heard(Spectator&, std::uint32_t);
+	const lmp::netbuf *compile(const Snapshot&, bool);
+	void restart();
+	void check_timeout();
+
+	std::vector<Spectator> spectators;
+	Stats stats;
+
+private:
+	std::unordered_map<std::int32_t, unsigned> index; // into <spectators>, by secret
+	std::deque<Broadcast> broadcasts; // recent ones, oldest first
+	std::uint32_t broadcast_seq; // number of broadcasts.back(), counting from 1
+	std::uint32_t keyframe_seq; // number of the latest broadcast without a baseline
+	std::uint32_t checksummed; // step the latest Checksum went out with
+	lmp::Traffic traffic; // of <buffer>
+	lmp::netbuf buffer; // the latest broadcast
+};
+
+#endif // BROADCAST_H
@@ -0,0 +1,60 @@
+#include "ClockSync.h"
+
+ClockSync::ClockSync()
+	: samples{}
+	, count(0)
+	, best(0)
+	, tick(0)
+{}
+
+// a datagram for server step <stepno> arrived at <now>, echoing our clock <echo> after the server held it <hold> ms.
+// <steps_per_second> is the server's tick
+void ClockSync::sample(std::int64_t now, std::uint16_t echo, std::uint16_t hold, std::uint32_t stepno, int steps_per_second)
+{
+	// our clock only goes out 16 bits wide
+	const int rtt = (std::uint16_t)(now - echo - hold);
+	if(rtt > 10000)
+		return; // the server's clock or ours is off, or it's ancient
+
+	// the old samples are of a different step counter
+	if(steps_per_second != tick)
+	{
+		count = 0;
+		tick = steps_per_second;
+	}
+
+	const unsigned slot = count % CLOCK_SAMPLES;
+	samples[slot].rtt = rtt;
+	samples[slot].origin = now - (rtt / 2.0) - (stepno * 1000.0 / tick);
+	++count;
+
+	best = 0;
+	const unsigned held = count < CLOCK_SAMPLES ? count : CLOCK_SAMPLES;
+	for(unsigned i = 1; i < held; ++i)
+		if(samples[i].rtt < samples[best].rtt)
+			best = i;
+}
+
+// the server's step counter started over, none of the samples hold anymore
+void ClockSync::reset()
+{
+	count = 0;
+	best = 0;
+}
+
+bool ClockSync::synced() const
+{
+	return count > 0;
+}
+
+// milliseconds
+int ClockSync::rtt() const
+{
+	return samples[best].rtt;
+}
+
+// the step the server is at, at our <now>. fractional
+double ClockSync::server_step(std::int64_t now) const
+{
+	return (now - samples[best].origin) * tick / 1000.0;
+}
@@ -0,0 +1,38 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <array>
+#include <cstdint>
+
+#define CLOCK_SAMPLES 16 // recent round trips the estimate picks the quickest of
+#define CLOCK_LEAD_MAX 30 // BASE_TICK steps at most that snapshots are moved ahead by
+
+// round trip time, and where the server's step counter is on our clock, ntp style.
+// every ClientInfo carries our clock, which the server echoes along with how long it held on to it. a datagram's
+// step went out about half a round trip before it arrived, and the sample with the shortest round trip had the
+// least queueing in it, so that's the one the estimate goes by
+class ClockSync
+{
+public:
+	ClockSync();
+
+	void sample(std::int64_t, std::uint16_t, std::uint16_t, std::uint32_t, int);
+	void reset();
+	bool synced() const;
+	int rtt() const;
+	double server_step(std::int64_t) const;
+
+private:
+	struct Sample
+	{
+		int rtt; // milliseconds
+		double origin; // our milliseconds() when the server would have been at step 0
+	};
+
+	std::array<Sample, CLOCK_SAMPLES> samples; // ring
+	unsigned count; // samples taken, the ring holds the last CLOCK_SAMPLES
+	unsigned best; // index of the one with the shortest round trip
+	int tick; // steps per second the samples were taken at
+};
+
+#endif // CLOCKSYNC_H
@@ -1,3 +1,5 @@
+#include <cstdlib>
+
 #include <QBoxLayout>
 #include <QFormLayout>
 #include <QPushButton>
@@ -5,6 +7,7 @@
 #include <QLabel>
 
 #include "Dialog.h"
+#include "Lump.h"
 #include "stbsrisrates.h"
 
 static const char *const helptext =
@@ -34,6 +37,22 @@ static const char *const helptext =
 "- If you die in this game, you die in real life."
 ;
 
+// "host:port" picks a port other than SERVER_PORT, e.g. a relay's. an address with more colons than that is ipv6
+static std::string host_of(const std::string &address)
+{
+	const std::size_t colon = address.find(':');
+
+	return colon != std::string::npos && address.find(':', colon + 1) == std::string::npos ? address.substr(0, colon) : address;
+}
+
+static unsigned short port_of(const std::string &address)
+{
+	const std::string host = host_of(address);
+	const unsigned port = host.size() < address.size() ? atoi(address.c_str() + host.size() + 1) : 0;
+
+	return port > 0 && port < 65536 ? port : SERVER_PORT;
+}
+
 dlg::Greeter::Greeter()
 {
 	setWindowTitle("Welcome to STBSRISRATES!");
@@ -44,12 +63,17 @@ dlg::Greeter::Greeter()
 	setLayout(vbox);
 
 	address = new QLineEdit;
-	address->setToolTip("Type in the IP Address of another player (who is hosting a match)");
+	address->setToolTip("Type in the IP Address of another player (who is hosting a match), or address:port for a relay");
 
 	auto connect = new QPushButton("Go");
 	auto host = new QPushButton("Host a Match");
 	auto howto = new QPushButton("How to Play");
 	auto quit = new QPushButton("Quit");
+	fast_join = new QCheckBox("Fast join (UDP only)");
+	fast_join->setChecked(true);
+	fast_join->setToolTip("Join with a single UDP exchange instead of a TCP connection");
+	watch = new QCheckBox("Spectate");
+	watch->setToolTip("Watch the match without playing in it");
 	connect->setToolTip("Connect to the host");
 	host->setToolTip("Host a match of your own, or play by yourself");
 	quit->setToolTip(":(");
@@ -75,6 +99,8 @@ dlg::Greeter::Greeter()
 	hbox->addWidget(connect);
 
 	vbox->addLayout(hbox);
+	vbox->addWidget(fast_join);
+	vbox->addWidget(watch);
 	vbox->addWidget(host);
 	vbox->addWidget(howto);
 	vbox->addWidget(quit);
@@ -85,8 +111,21 @@ std::string dlg::Greeter::addr() const
 	return address->text().toStdString();
 }
 
-dlg::Connect::Connect(const std::string &address)
-	: connector(address, SERVER_PORT)
+bool dlg::Greeter::udp_join() const
+{
+	return fast_join->isChecked();
+}
+
+bool dlg::Greeter::spectate() const
+{
+	return watch->isChecked();
+}
+
+// spectators can only join over udp
+dlg::Connect::Connect(const std::string &address, bool udp_join, bool spectate)
+	: udp(host_of(address), port_of(address))
+	, nonce(mersenne()(0, 2'000'000'000))
+	, spectating(spectate)
 	, addr(address)
 	, start_time(time(NULL))
 {
@@ -98,12 +137,13 @@ dlg::Connect::Connect(const std::string &address)
 	auto label = new QLabel(("Connecting to " + addr).c_str());
 	auto cancel = new QPushButton("Cancel");
 
+	udp_join = udp_join || spectating;
 	vbox->addWidget(label);
 	vbox->addWidget(cancel);
 
 	QObject::connect(cancel, &QPushButton::clicked, this, &QDialog::reject);
 
-	if(!connector)
+	if(!udp || (!udp_join && !connector.target(host_of(addr), port_of(addr))))
 	{
 		QTimer::singleShot(0, [this]
 		{
@@ -115,38 +155,96 @@ dlg::Connect::Connect(const std::string &address)
 	}
 
 	timer = new QTimer(this);
-	QObject::connect(timer, &QTimer::timeout, [this]
+	QObject::connect(timer, &QTimer::timeout, [this, udp_join]
 	{
 		if(time(NULL) - start_time > 10)
 		{
+			timer->stop();
 			QMessageBox::critical(this, "Could not connect", ("Could not connect to " + addr + ", timeout!").c_str());
 			reject();
 			return;
 		}
 
-		if(!connector.connect())
-			return;
+		if(udp_join)
+			poll_udp();
+		else
+			poll_tcp();
+	});
+
+	if(udp_join)
+	{
+		// the request is resent on every tick until a reply comes back
+		poll_udp();
+		timer->start(100);
+	}
+	else
+		timer->start(300);
+}
+
+int dlg::Connect::secret() const
+{
+	return udp_secret;
+}
+
+// the socket the game should keep using.
+// udp joins are tied to the address they were made from, so it has to be this one
+net::udp &dlg::Connect::socket()
+{
+	return udp;
+}
+
+void dlg::Connect::poll_tcp()
+{
+	if(!connector.connect())
+		return;
+
+	timer->stop();
+
+	std::uint8_t accepted = 0;
+	connector.recv_block(&accepted, sizeof(accepted));
+	if(!accepted)
+	{
+		QMessageBox::critical(this, "Could not connect", ("Could not connect to " + addr + ", server is full!").c_str());
+		reject();
+		return;
+	}
+
+	connector.recv_block(&udp_secret, sizeof(udp_secret));
+	accept();
+}
+
+void dlg::Connect::poll_udp()
+{
+	lmp::netbuf buffer;
+
+	while(lmp::netbuf::get(buffer, udp))
+	{
+		lmp::JoinReply reply;
+		if(!buffer.pop(reply) || reply.nonce != nonce)
+		{
+			buffer.reset();
+			continue;
+		}
 
 		timer->stop();
 
-		std::uint8_t accepted = 0;
-		connector.recv_block(&accepted, sizeof(accepted));
-		if(!accepted)
+		if(!reply.accepted)
 		{
-			QMessageBox::critical(this, "Could not connect", ("Could not connect to " + addr + ", server is full!").c_str());
+			QMessageBox::critical(this, "Could not connect", ("Could not connect to " + addr + (spectating ? ", server isn't taking spectators!" : ", server is full!")).c_str());
 			reject();
 			return;
 		}
 
-		connector.recv_block(&udp_secret, sizeof(udp_secret));
+		udp_secret = reply.secret;
 		accept();
-	});
-	timer->start(300);
-}
+		return;
+	}
 
-int dlg::Connect::secret() const
-{
-	return udp_secret;
+	lmp::JoinRequest request;
+	request.nonce = nonce;
+	request.spectate = spectating;
+	buffer.push(request);
+	udp.send(buffer.raw.data(), buffer.size);
 }
 
 void dlg::HelpBox(QWidget *parent)
@@ -2,6 +2,7 @@
 #define DIALOG_H
 
 #include <QDialog>
+#include <QCheckBox>
 #include <QLineEdit>
 #include <QTimer>
 
@@ -14,21 +15,32 @@ namespace dlg
 	public:
 		Greeter();
 		std::string addr() const;
+		bool udp_join() const;
+		bool spectate() const;
 
 	private:
 		QLineEdit *address;
+		QCheckBox *fast_join;
+		QCheckBox *watch;
 	};
 
 	class Connect : public QDialog
 	{
 	public:
-		Connect(const std::string&);
+		Connect(const std::string&, bool, bool);
 		int secret() const;
+		net::udp &socket();
 
 	private:
+		void poll_tcp();
+		void poll_udp();
+
 		std::int32_t udp_secret;
 		QTimer *timer;
 		net::tcp connector;
+		net::udp udp;
+		std::uint32_t nonce;
+		const bool spectating;
 		const std::string addr;
 		const int start_time;
 	};
@@ -1,21 +1,23 @@
+#include <algorithm>
+
 #include "GameState.h"
 #include "Server.h"
 
-GameState GameState::blank;
+int World::left = -400;
+int World::top = -400;
+int World::width = DEFAULT_WORLD_WIDTH;
+int World::height = DEFAULT_WORLD_HEIGHT;
+int World::columns = 1;
+int World::rows = 1;
+int World::tick = BASE_TICK;
+float World::delta = 1.0f;
 
 GameState::GameState()
 	: stepno(0)
 	, score(0)
 	, paused(false)
-{}
-
-GameState::GameState(const GameState &rhs)
-	: asteroid_list(rhs.asteroid_list)
-	, player_list(rhs.player_list)
-	, ship_list(rhs.ship_list)
-	, stepno(rhs.stepno)
-	, score(rhs.score)
-	, paused(rhs.paused)
+	, last_asteroid_id(0)
+	, last_ship_id(0)
 {}
 
 void GameState::reset()
@@ -28,11 +30,173 @@ void GameState::reset()
 	}
 
 	asteroid_list.clear();
+	dormant.clear();
 	bullet_list.clear();
 	ship_list.clear();
 	score = 0;
 }
 
+// start over from nothing at step <step>, with fresh players for <roster> in that order.
+// the result depends on nothing else, so separate machines restarting alike end up bit identical
+void GameState::restart(const std::vector<std::int32_t> &roster, unsigned step)
+{
+	player_list.clear();
+	for(const std::int32_t id : roster)
+		player_list.push_back(Player(id));
+
+	reset();
+	active.clear();
+	stepno = step;
+	paused = false;
+	last_asteroid_id = 0;
+	last_ship_id = 0;
+}
+
+// fnv-1a over every bit the simulation reads, to tell whether two copies of the state still agree
+std::uint32_t GameState::checksum() const
+{
+	std::uint32_t hash = 2166136261u;
+	const auto mix = [&hash](const void *data, unsigned len)
+	{
+		const std::uint8_t *const bytes = (const std::uint8_t*)data;
+		for(unsigned i = 0; i < len; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+	};
+	const auto mix_entity = [&mix](const Entity &e)
+	{
+		const float fields[] = { e.x, e.y, e.w, e.h, e.rot, e.xv, e.yv };
+		mix(fields, sizeof(fields));
+	};
+
+	for(const Player &p : player_list)
+	{
+		mix_entity(p);
+		const float fields[] = { p.health, p.timer_fire, p.timer_idle, p.percent_repair };
+		const int ints[] = { p.id, p.shooting, p.repairing_id };
+		mix(fields, sizeof(fields));
+		mix(ints, sizeof(ints));
+	}
+
+	const auto mix_asteroid = [&mix, &mix_entity](const Asteroid &a)
+	{
+		mix_entity(a);
+		const int ints[] = { (int)a.type, a.id, a.health };
+		mix(ints, sizeof(ints));
+		mix(&a.rotv, sizeof(a.rotv));
+	};
+	for(const Asteroid &a : asteroid_list)
+		mix_asteroid(a);
+	for(const std::vector<Asteroid> &sector : dormant)
+		for(const Asteroid &a : sector)
+			mix_asteroid(a);
+
+	for(const Bullet &b : bullet_list)
+	{
+		mix_entity(b);
+		mix(&b.ttl, sizeof(b.ttl));
+	}
+
+	for(const Ship &s : ship_list)
+	{
+		mix_entity(s);
+		const int ints[] = { s.id, s.health };
+		const float fields[] = { s.wear, s.ttl };
+		mix(ints, sizeof(ints));
+		mix(fields, sizeof(fields));
+	}
+
+	const int ints[] = { (int)stepno, score, paused, last_asteroid_id, last_ship_id };
+	mix(ints, sizeof(ints));
+
+	return hash;
+}
+
+// sectors within one sector of a living or dead player are awake, the rest sleep. asteroids in sleeping sectors
+// are set aside in <dormant> and don't move, collide, break up or respawn until somebody comes near again, so
+// simulation cost follows the players instead of the size of the world. the default world is one sector
+void GameState::update_sectors()
+{
+	const int count = World::sectors();
+	dormant.resize(count);
+	active.assign(count, false);
+
+	for(const Player &player : player_list)
+	{
+		const int sector = World::sector(player);
+		const int column = sector % World::columns;
+		const int row = sector / World::columns;
+
+		for(int r = std::max(row - 1, 0); r <= std::min(row + 1, World::rows - 1); ++r)
+			for(int c = std::max(column - 1, 0); c <= std::min(column + 1, World::columns - 1); ++c)
+				active[(r * World::columns) + c] = true;
+	}
+
+	// put to sleep
+	for(const Asteroid &aster : asteroid_list)
+	{
+		const int sector = World::sector(aster);
+		if(!active[sector])
+			dormant[sector].push_back(aster);
+	}
+	asteroid_list.erase(std::remove_if(asteroid_list.begin(), asteroid_list.end(), [this](const Asteroid &aster)
+	{
+		return !active[World::sector(aster)];
+	}), asteroid_list.end());
+
+	// wake up
+	for(int sector = 0; sector < count; ++sector)
+	{
+		if(!active[sector] || dormant[sector].empty())
+			continue;
+
+		asteroid_list.insert(asteroid_list.end(), dormant[sector].begin(), dormant[sector].end());
+		dormant[sector].clear();
+	}
+}
+
+// *********
+// *********
+// WORLD
+// *********
+// *********
+
+// the player starts out at the origin, 2/5 of the way in from the top left corner
+void World::resize(int w, int h)
+{
+	width = std::min(std::max(w, MIN_WORLD_SIZE), MAX_WORLD_SIZE);
+	height = std::min(std::max(h, MIN_WORLD_SIZE), MAX_WORLD_SIZE);
+	left = -((width * 2) / 5);
+	top = -((height * 2) / 5);
+	columns = (width + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	rows = (height + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+void World::pace(int steps_per_second)
+{
+	tick = std::min(std::max(steps_per_second, MIN_TICK), MAX_TICK);
+	delta = (float)BASE_TICK / tick;
+}
+
+void World::bounds(int sector, float &l, float &t, float &r, float &b)
+{
+	l = left + ((sector % columns) * SECTOR_SIZE);
+	t = top + ((sector / columns) * SECTOR_SIZE);
+	r = std::min<float>(l + SECTOR_SIZE, WORLD_RIGHT);
+	b = std::min<float>(t + SECTOR_SIZE, WORLD_BOTTOM);
+}
+
+// by center. things outside the world count as in the nearest sector
+int World::sector(const Entity &subject)
+{
+	const int column = (subject.x + (subject.w / 2) - left) / SECTOR_SIZE;
+	const int row = (subject.y + (subject.h / 2) - top) / SECTOR_SIZE;
+
+	return (std::min(std::max(row, 0), rows - 1) * columns) + std::min(std::max(column, 0), columns - 1);
+}
+
 // *********
 // *********
 // BASE ENTITY
@@ -81,128 +245,91 @@ Player::Player(int ident)
 	, repairing_id(-1)
 {}
 
-void Player::step(bool server, const Controls &controls, GameState &state, float delta, mersenne &random)
+// server side: speed and heading from the controls, held inside the world, plus the timers.
+// <delta> is the length of the step in BASE_TICK steps
+void Player::integrate(const Controls &controls, float delta)
 {
-	if(server)
+	if(health > 0)
 	{
-		if(health > 0)
-		{
-			const float travel_angle = atan2f(controls.y, controls.x);
-			const float intensity = sqrtf(powf(controls.x, 2) + powf(controls.y, 2));
-			const float normal_intensity = intensity > 1.0f ? 1.0f : intensity;
-			const float xvel = cosf(travel_angle) * normal_intensity * PLAYER_MAX_SPEED;
-			const float yvel = -sinf(travel_angle) * normal_intensity * PLAYER_MAX_SPEED;
+		const float travel_angle = atan2f(controls.y, controls.x);
+		const float intensity = sqrtf(powf(controls.x, 2) + powf(controls.y, 2));
+		const float normal_intensity = intensity > 1.0f ? 1.0f : intensity;
+		const float xvel = cosf(travel_angle) * normal_intensity * PLAYER_MAX_SPEED;
+		const float yvel = -sinf(travel_angle) * normal_intensity * PLAYER_MAX_SPEED;
 
-			targetf(&xv, PLAYER_SPEEDUP, xvel);
-			targetf(&yv, PLAYER_SPEEDUP, yvel);
+		targetf(&xv, PLAYER_SPEEDUP * delta, xvel);
+		targetf(&yv, PLAYER_SPEEDUP * delta, yvel);
 
-			if(fabsf(xvel) > 0.0f || fabsf(yvel) > 0.0f)
-				timer_idle = 0;
-		}
-		else
-		{
-			zerof(&xv, PLAYER_SPEEDUP);
-			zerof(&yv, PLAYER_SPEEDUP);
-		}
+		if(fabsf(xvel) > 0.0f || fabsf(yvel) > 0.0f)
+			timer_idle = 0;
+	}
+	else
+	{
+		zerof(&xv, PLAYER_SPEEDUP * delta);
+		zerof(&yv, PLAYER_SPEEDUP * delta);
+	}
 
-		rot = controls.angle;
+	rot = controls.angle;
 
-		// clamp
-		if(xv > PLAYER_MAX_SPEED)
-			xv = PLAYER_MAX_SPEED;
-		else if(xv < -PLAYER_MAX_SPEED)
-			xv = -PLAYER_MAX_SPEED;
-		if(yv > PLAYER_MAX_SPEED)
-			yv = PLAYER_MAX_SPEED;
-		else if(yv < -PLAYER_MAX_SPEED)
-			yv = -PLAYER_MAX_SPEED;
+	// clamp
+	if(xv > PLAYER_MAX_SPEED)
+		xv = PLAYER_MAX_SPEED;
+	else if(xv < -PLAYER_MAX_SPEED)
+		xv = -PLAYER_MAX_SPEED;
+	if(yv > PLAYER_MAX_SPEED)
+		yv = PLAYER_MAX_SPEED;
+	else if(yv < -PLAYER_MAX_SPEED)
+		yv = -PLAYER_MAX_SPEED;
 
-		x += xv * delta;
-		y += yv * delta;
+	x += xv * delta;
+	y += yv * delta;
 
-		// prevent player from leaving world boundaries
-		if(x < WORLD_LEFT)
-		{
-			x = WORLD_LEFT;
-			xv = 0.0f;
-		}
-		else if(x + PLAYER_WIDTH > WORLD_LEFT + WORLD_WIDTH)
-		{
-			x = WORLD_LEFT + WORLD_WIDTH - PLAYER_WIDTH;
-			xv = 0.0f;
-		}
-		if(y < WORLD_TOP)
-		{
-			y = WORLD_TOP;
-			yv = 0.0f;
-		}
-		else if(y + PLAYER_HEIGHT > WORLD_TOP + WORLD_HEIGHT)
-		{
-			y = WORLD_TOP + WORLD_HEIGHT - PLAYER_HEIGHT;
-			yv = 0.0f;
-		}
+	// prevent player from leaving world boundaries
+	if(x < WORLD_LEFT)
+	{
+		x = WORLD_LEFT;
+		xv = 0.0f;
 	}
-
-	bool colliding = false;
-	if(server && health > 0)
+	else if(x + PLAYER_WIDTH > WORLD_LEFT + WORLD_WIDTH)
 	{
-		// check for players hovering over other players
-		for(Player &other : state.player_list)
-		{
-			if(this == &other || other.health > 0)
-				continue;
-
-			if(collide(other) && (repairing_id == -1 || repairing_id == other.id))
-			{
-				colliding = true;
-
-				shooting = false;
-				repairing_id = other.id;
-				percent_repair += 0.25f;
-				if(percent_repair >= 100)
-				{
-					colliding = false;
-					other.health = 100;
-				}
-			}
-
-			break;
-		}
+		x = WORLD_LEFT + WORLD_WIDTH - PLAYER_WIDTH;
+		xv = 0.0f;
+	}
+	if(y < WORLD_TOP)
+	{
+		y = WORLD_TOP;
+		yv = 0.0f;
 	}
-	if(!colliding)
+	else if(y + PLAYER_HEIGHT > WORLD_TOP + WORLD_HEIGHT)
 	{
-		percent_repair = 0;
-		repairing_id = -1;
+		y = WORLD_TOP + WORLD_HEIGHT - PLAYER_HEIGHT;
+		yv = 0.0f;
 	}
 
 	if(timer_fire > 0.0f)
 		timer_fire -= delta;
 
-	if(shooting && timer_fire <= 0.0f && health > 0)
-	{
-		timer_idle = 0;
-		const float plusminus = 0.02f;
-		state.bullet_list.push_back({int(x + (PLAYER_WIDTH / 2)), int(y + (PLAYER_HEIGHT / 2)), rot + random(-plusminus, plusminus)});
-		timer_fire = PLAYER_TIMER_FIRE;
-	}
-
-	++timer_idle;
-	if(server && timer_idle > PLAYER_TIMER_IDLE && health < 100 && health > 0)
+	timer_idle += delta;
+	if(timer_idle > PLAYER_TIMER_IDLE && health < 100 && health > 0)
 	{
-		health += 0.2f;
+		health += 0.2f * delta;
 		if(health > 100)
 			health = 100;
 	}
 }
 
-bool Player::diff(const Player &p) const
+// client side: the server says when it's shooting, the bullets here are just for show
+void Player::step(GameState &state, float delta, mersenne &random)
 {
-	return
-		shooting != p.shooting ||
-		health != p.health ||
-		x != p.x ||
-		y != p.y ||
-		rot != p.rot;
+	if(timer_fire > 0.0f)
+		timer_fire -= delta;
+
+	if(shooting && timer_fire <= 0.0f && health > 0)
+	{
+		const float plusminus = 0.02f;
+		state.bullet_list.push_back({int(x + (PLAYER_WIDTH / 2)), int(y + (PLAYER_HEIGHT / 2)), rot + random(-plusminus, plusminus)});
+		timer_fire = PLAYER_TIMER_FIRE;
+	}
 }
 
 // *********
@@ -211,8 +338,7 @@ bool Player::diff(const Player &p) const
 // *********
 // *********
 
-int Asteroid::last_id = 0;
-Asteroid::Asteroid(AsteroidType t, mersenne &random, const Asteroid *parent, int ident)
+template <typename Random> Asteroid::Asteroid(AsteroidType t, Random &random, const Asteroid *parent, int ident)
 	: Entity(0, 0, size(t), size(t))
 	, type(t)
 	, id(ident)
@@ -236,152 +362,53 @@ Asteroid::Asteroid(AsteroidType t, mersenne &random, const Asteroid *parent, int
 		yv = sinf(rot) * speedmod;
 	}
 }
+template Asteroid::Asteroid(AsteroidType, mersenne&, const Asteroid*, int);
+template Asteroid::Asteroid(AsteroidType, splitmix&, const Asteroid*, int);
 
-void Asteroid::step(bool server, GameState &state, std::vector<Particle> *particle_list, mersenne &random, float delta)
+// drift, bouncing off the world edges
+void Asteroid::move(float delta)
 {
-	if(server)
-	{
-		// figure out potential # of asteroids
-		int potential = 0;
-		for(const Asteroid &aster : state.asteroid_list)
-		{
-			if(aster.type == AsteroidType::BIG)
-				potential += 9;
-			else if(aster.type == AsteroidType::MED)
-				potential += 3;
-			else if(aster.type == AsteroidType::SMALL)
-				potential += 1;
-			else
-				hcf("invalid asteroid type");
-		}
-
-		if(potential <= MAX_ASTEROIDS - 9)
-		{
-			Asteroid a(AsteroidType::BIG, random, NULL);
+	x += xv * delta;
+	y += yv * delta;
+	rot += rotv * delta;
 
-			// make sure new guy is not colliding with any players
-			bool colliding = false;
-			for(const Player &player : state.player_list)
-			{
-				if(player.collide(a, -75))
-				{
-					colliding = true;
-					break;
-				}
-			}
-
-			// make sure new guy is not colliding with any ships
-			for(const Ship &ship : state.ship_list)
-			{
-				if(ship.collide(a, -100))
-				{
-					colliding = true;
-					break;
-				}
-			}
-
-			if(!colliding)
-				state.asteroid_list.push_back(a);
-		}
+	if(x < WORLD_LEFT)
+	{
+		x = WORLD_LEFT;
+		xv = -xv;
+	}
+	else if(x + w > WORLD_RIGHT)
+	{
+		x = WORLD_RIGHT - w;
+		xv = -xv;
 	}
 
-	std::vector<Asteroid> intermediate;
-
-	for(auto it = state.asteroid_list.begin(); it != state.asteroid_list.end();)
+	if(y < WORLD_TOP)
 	{
-		Asteroid &aster = *it;
+		y = WORLD_TOP;
+		yv = -yv;
+	}
+	else if(y + h > WORLD_BOTTOM)
+	{
+		y = WORLD_BOTTOM - h;
+		yv = -yv;
+	}
+}
 
+// client side extrapolation. the real thing is in Simulation.cpp
+void Asteroid::step(GameState &state, std::vector<Particle> &particle_list, mersenne &random, float delta)
+{
+	for(Asteroid &aster : state.asteroid_list)
+	{
 		// check for collisions with player
-		for(Player &player : state.player_list)
+		for(const Player &player : state.player_list)
 		{
 			if(player.health > 0 && aster.collide(player, 10))
-			{
-				if(server)
-				{
-					player.health -= 2;
-					player.timer_idle = 0;
-				}
-				else
-					Particle::create(*particle_list, player.x + (PLAYER_WIDTH / 2), player.y + (PLAYER_HEIGHT / 2), 10, random);
-			}
-		}
-
-		const float mult = server ? 1.0f : delta;
-		aster.x += aster.xv * mult;
-		aster.y += aster.yv * mult;
-		aster.rot += aster.rotv * mult;
-
-		if(aster.x < WORLD_LEFT)
-		{
-			aster.x = WORLD_LEFT;
-			aster.xv = -aster.xv;
-		}
-		else if(aster.x + aster.w > WORLD_RIGHT)
-		{
-			aster.x = WORLD_RIGHT - aster.w;
-			aster.xv = -aster.xv;
-		}
-
-		if(aster.y < WORLD_TOP)
-		{
-			aster.y = WORLD_TOP;
-			aster.yv = -aster.yv;
-		}
-		else if(aster.y + aster.h > WORLD_BOTTOM)
-		{
-			aster.y = WORLD_BOTTOM - aster.h;
-			aster.yv = -aster.yv;
-		}
-
-		// sometimes asteroids explode
-		const float probability_mult = state.asteroid_list.size() > 20 ? 1.0f : 0.5f;
-		int probability = 0;
-		if(aster.type == AsteroidType::BIG)
-			probability = 1800 * probability_mult;
-		else if(aster.type == AsteroidType::MED)
-			probability = 2200 * probability_mult;
-		else
-			probability = 1600;
-		if(random(probability) && server)
-		{
-			const AsteroidType newtype = Asteroid::next(aster.type);
-			if(newtype != AsteroidType::NONE)
-			{
-				for(int i = 0; i < 3; ++i)
-				{
-					intermediate.push_back(Asteroid(newtype, random, &aster));
-				}
-			}
-
-			it = state.asteroid_list.erase(it);
-			continue;
+				Particle::create(particle_list, player.x + (PLAYER_WIDTH / 2), player.y + (PLAYER_HEIGHT / 2), 10, random);
 		}
 
-		++it;
+		aster.move(delta);
 	}
-
-	if(server)
-	{
-		// add the intermediate asteroids
-		for(Asteroid &aster : intermediate)
-		{
-			// augment its speed
-			const float angle = random(0.0, 2 * 3.1415926);
-			const int explode_speed = random(1.0, 3.0);
-
-			aster.xv = cosf(angle) * explode_speed;
-			aster.yv = sinf(angle) * explode_speed;
-
-			state.asteroid_list.push_back(aster);
-		}
-	}
-}
-
-bool Asteroid::diff(const Asteroid &a) const
-{
-	return
-		xv != a.xv ||
-		yv != a.yv;
 }
 
 AsteroidType Asteroid::next(AsteroidType t)
@@ -464,98 +491,57 @@ Bullet::Bullet(int X, int Y, float ROT)
 	yv = sinf(rot) * BULLET_SPEED;
 }
 
-void Bullet::step(bool server, GameState &state, std::vector<Particle> *particle_list, mersenne &random)
+// false once it's left the world
+bool Bullet::move(float delta)
+{
+	x += xv * delta;
+	y += yv * delta;
+
+	return x <= WORLD_RIGHT && x >= WORLD_LEFT && y >= WORLD_TOP && y <= WORLD_BOTTOM;
+}
+
+// client side, for show. the real thing is in Simulation.cpp
+void Bullet::step(GameState &state, std::vector<Particle> &particle_list, std::vector<Sound> &sounds, mersenne &random, float delta)
 {
 	for(auto it = state.bullet_list.begin(); it != state.bullet_list.end();)
 	{
 		Bullet &bullet = *it;
 
-		bullet.x += bullet.xv;
-		bullet.y += bullet.yv;
-
 		// check for collision with world boundary
-		bool remove = false;
-		if(bullet.x > WORLD_RIGHT)
-		{
-			remove = true;
-			if(!server)
-				Particle::create(*particle_list, WORLD_RIGHT, bullet.y, 3, random);
-		}
-		else if(bullet.x < WORLD_LEFT)
-		{
-			remove = true;
-			if(!server)
-				Particle::create(*particle_list, WORLD_LEFT, bullet.y, 3, random);
-		}
-		if(bullet.y < WORLD_TOP)
-		{
-			remove = true;
-			if(!server)
-				Particle::create(*particle_list, bullet.x, WORLD_TOP, 3, random);
-		}
-		else if(bullet.y > WORLD_BOTTOM)
+		if(!bullet.move(delta))
 		{
-			remove = true;
-			if(!server)
-				Particle::create(*particle_list, bullet.x, WORLD_BOTTOM, 3, random);
-		}
-		if(remove)
-		{
-			state.bullet_list.erase(it);
+			const float x = std::min<float>(std::max<float>(bullet.x, WORLD_LEFT), WORLD_RIGHT);
+			const float y = std::min<float>(std::max<float>(bullet.y, WORLD_TOP), WORLD_BOTTOM);
+			Particle::create(particle_list, x, y, 3, random);
+
+			it = state.bullet_list.erase(it);
 			continue;
 		}
 
 		// check for collision with asteroids
 		bool stop = false;
-		for(auto it2 = state.asteroid_list.begin(); it2 != state.asteroid_list.end();)
+		for(const Asteroid &aster : state.asteroid_list)
 		{
-			Asteroid &aster = *it2;
-
 			if(bullet.collide(aster))
 			{
-				if(server)
-				{
-					// align asteroid direction with bullet direction
-					targetf(&aster.xv, 1.0 / (aster.w / 30.0f), bullet.xv / 2.0);
-					targetf(&aster.yv, 1.0 / (aster.h / 30.0f), bullet.yv / 2.0);
-
-					aster.health -= random(4, 7);
-					// maybe delete the asteroid
-					if(aster.health < 1)
-					{
-						state.score += Asteroid::score(aster.type);
-						const AsteroidType t = Asteroid::next(aster.type);
-						Asteroid parent = aster;
-
-						it2 = state.asteroid_list.erase(it2);
-
-						if(t != AsteroidType::NONE)
-						{
-							for(int i = 0; i < 3; ++i)
-								state.asteroid_list.push_back({t, random, &parent});
-						}
-					}
-				}
-				else{
-					// generate particles
-					Particle::create(*particle_list, bullet.x, bullet.y, 6, random);
-				}
+				// generate particles
+				Particle::create(particle_list, bullet.x, bullet.y, 6, random);
+				sounds.push_back({Sound::HIT, bullet.x, bullet.y});
 
 				// delete the bullet
 				it = state.bullet_list.erase(it);
 				stop = true;
 				break;
 			}
-
-			++it2;
 		}
 
 		if(stop)
 			continue;
 
-		if(--bullet.ttl == 0)
+		bullet.ttl -= delta;
+		if(bullet.ttl <= 0.0f)
 		{
-			state.bullet_list.erase(it);
+			it = state.bullet_list.erase(it);
 			continue;
 		}
 
@@ -568,11 +554,11 @@ void Bullet::step(bool server, GameState &state, std::vector<Particle> *particle
 // SHIPS
 // *********
 // *********
-int Ship::last_id = 0;
-Ship::Ship(mersenne &random, int ID)
+template <typename Random> Ship::Ship(Random &random, int ID)
 	: Entity(0, 0, SHIP_WIDTH, SHIP_HEIGHT)
 	, id(ID)
 	, health(100)
+	, wear(0.0f)
 	, ttl(100)
 {
 	const bool going_left = random(2);
@@ -589,32 +575,31 @@ Ship::Ship(mersenne &random, int ID)
 		xv = SHIP_SPEED;
 	}
 }
+template Ship::Ship(mersenne&, int);
+template Ship::Ship(splitmix&, int);
 
-void Ship::step(bool server, GameState &state, std::vector<Particle> *particle_list, float delta, mersenne &random)
+// live ships cruise across (quickly, while off the map), dead ones burn out
+void Ship::move(float delta)
 {
-	if(server && random(800) && state.ship_list.size() == 0)
-		state.ship_list.push_back({random});
-
-	for(auto it = state.ship_list.begin(); it != state.ship_list.end();)
+	if(health < 1)
 	{
-		Ship &ship = *it;
+		ttl -= delta;
+		return;
+	}
 
-		float xv = ship.xv;
-		if(ship.x < WORLD_LEFT - (SHIP_WIDTH * 2) || ship.x > WORLD_RIGHT + SHIP_WIDTH)
-			xv *= 5;
+	float speed = xv;
+	if(x < WORLD_LEFT - (SHIP_WIDTH * 2) || x > WORLD_RIGHT + SHIP_WIDTH)
+		speed *= 5;
 
-		if(ship.health > 0)
-			ship.x += xv * delta;
+	x += speed * delta;
+}
 
-		if(ship.health < 1 && ship.ttl <= 0.0f && server)
-		{
-			it = state.ship_list.erase(it);
-			// remove some score
-			state.score -= 50;
-			continue;
-		}
-		else if(ship.health < 1)
-			ship.ttl -= delta;
+// client side extrapolation. the real thing is in Simulation.cpp
+void Ship::step(GameState &state, std::vector<Particle> &particle_list, float delta, mersenne &random)
+{
+	for(Ship &ship : state.ship_list)
+	{
+		ship.move(delta);
 
 		// check for collisions with asteroid
 		if(ship.health > 0)
@@ -622,39 +607,12 @@ void Ship::step(bool server, GameState &state, std::vector<Particle> *particle_l
 			for(const Asteroid &aster : state.asteroid_list)
 			{
 				if(aster.collide(ship))
-				{
-					if(server)
-						ship.health -= 2;
-					else
-						Particle::create(*particle_list, ship.x + (SHIP_WIDTH / 2), ship.y + (SHIP_HEIGHT / 2), 30, random);
-				}
+					Particle::create(particle_list, ship.x + (SHIP_WIDTH / 2), ship.y + (SHIP_HEIGHT / 2), 30, random);
 			}
 		}
-
-		if(server)
-		{
-			if((ship.xv > 0.0f && ship.x > WORLD_RIGHT + 1000) || (ship.xv < 0.0f && ship.x < WORLD_LEFT - 1000))
-			{
-				// up the score
-				state.score += 50;
-
-				state.ship_list.erase(it);
-
-				continue;
-			}
-		}
-
-		++it;
 	}
 }
 
-bool Ship::diff(const Ship &other) const
-{
-	return
-		health != other.health ||
-		xv != other.xv;
-}
-
 // *********
 // *********
 // PARTICLES
@@ -5,11 +5,10 @@
 
 #include "stbsrisrates.h"
 
-#define STATE_HISTORY 256
-
 struct Bullet;
 struct GameState;
 struct Particle;
+struct Sound;
 
 enum class AsteroidType : std::uint8_t
 {
@@ -60,6 +59,38 @@ struct Entity
 	};
 };
 
+#define DEFAULT_WORLD_WIDTH 1000
+#define DEFAULT_WORLD_HEIGHT 1000
+#define MIN_WORLD_SIZE 500
+#define MAX_WORLD_SIZE 100000
+#define SECTOR_SIZE 1000 // asteroids are budgeted, spawned and put to sleep per square sector this big
+#define BASE_TICK 60 // speeds, timers and odds are all written per step at this rate
+#define MIN_TICK 10
+#define MAX_TICK 240
+
+// the arena, and how fast time passes in it. it's fixed for a match: the server sets it up at startup
+// and clients hear about it in ServerInfo
+struct World
+{
+	static void resize(int, int);
+	static void pace(int);
+	static void bounds(int, float&, float&, float&, float&);
+	static int sector(const Entity&);
+	static int sectors() { return columns * rows; }
+
+	static int left, top, width, height;
+	static int columns, rows; // sectors across and down
+	static int tick; // simulation steps per second
+	static float delta; // one step, in BASE_TICK steps
+};
+
+#define WORLD_LEFT World::left
+#define WORLD_WIDTH World::width
+#define WORLD_TOP World::top
+#define WORLD_HEIGHT World::height
+#define WORLD_RIGHT (WORLD_LEFT + WORLD_WIDTH)
+#define WORLD_BOTTOM (WORLD_TOP + WORLD_HEIGHT)
+
 #define PLAYER_WIDTH 30
 #define PLAYER_HEIGHT 30
 #define PLAYER_SPEEDUP 1
@@ -70,8 +101,8 @@ struct Player : Entity
 {
 	Player(int);
 
-	void step(bool, const Controls&, GameState&, float delta, mersenne&);
-	bool diff(const Player&) const;
+	void integrate(const Controls&, float);
+	void step(GameState&, float delta, mersenne&);
 
 	int id;
 	bool shooting;
@@ -84,14 +115,12 @@ struct Player : Entity
 
 struct Asteroid : Entity
 {
-	Asteroid(AsteroidType, mersenne&, const Asteroid*, int = ++last_id);
+	template <typename Random> Asteroid(AsteroidType, Random&, const Asteroid*, int);
 
-	bool diff(const Asteroid&) const;
+	void move(float);
 
-	static void step(bool, GameState&, std::vector<Particle>*, mersenne&, float);
+	static void step(GameState&, std::vector<Particle>&, mersenne&, float);
 	static AsteroidType next(AsteroidType);
-
-	static int last_id;
 	static int size(AsteroidType);
 	static int durability(AsteroidType);
 	static int score(AsteroidType);
@@ -109,7 +138,9 @@ struct Bullet : Entity
 {
 	Bullet(int, int, float);
 
-	static void step(bool, GameState&, std::vector<Particle>*, mersenne&);
+	bool move(float);
+
+	static void step(GameState&, std::vector<Particle>&, std::vector<Sound>&, mersenne&, float);
 
 	float ttl;
 };
@@ -119,14 +150,14 @@ struct Bullet : Entity
 #define SHIP_SPEED 1
 struct Ship : Entity
 {
-	Ship(mersenne&, int = ++last_id);
+	template <typename Random> Ship(Random&, int);
 
-	static void step(bool step, GameState&, std::vector<Particle>*, float, mersenne&);
-	bool diff(const Ship&) const;
-	static int last_id;
+	static void step(GameState&, std::vector<Particle>&, float, mersenne&);
+	void move(float);
 
 	int id;
 	int health;
+	float wear; // contact damage short of a whole point, carried over to the next step
 	float ttl;
 };
 
@@ -141,6 +172,23 @@ struct Particle : Entity
 	float ttl;
 };
 
+// something the client saw happen that makes a noise. client side, for show
+struct Sound
+{
+	enum Effect : std::uint8_t
+	{
+		SHOT,
+		HIT, // a bullet on an asteroid
+		EXPLOSION, // an asteroid
+		BLAST, // the cruiser
+
+		EFFECT_COUNT
+	};
+
+	Effect effect;
+	float x, y;
+};
+
 #define FIREWORK_SIZE 16
 #define FIREWORK_TTL 60, 90
 #define FIREWORK_SPEED 1.0, 2.4
@@ -198,60 +246,24 @@ struct Firework : Entity
 struct GameState
 {
 	GameState();
-	GameState(const GameState&);
+	GameState(const GameState&) = delete;
 	void operator=(const GameState&) = delete;
 
 	void reset();
+	void restart(const std::vector<std::int32_t>&, unsigned);
+	void update_sectors();
+	std::uint32_t checksum() const;
 
-	static GameState blank;
-	std::vector<Asteroid> asteroid_list;
+	std::vector<Asteroid> asteroid_list; // just the awake ones
+	std::vector<std::vector<Asteroid>> dormant; // asteroids in sleeping sectors, by sector
+	std::vector<bool> active; // awake sectors, as of the last update_sectors()
 	std::vector<Bullet> bullet_list;
 	std::vector<Player> player_list;
 	std::vector<Ship> ship_list;
 	unsigned stepno;
 	int score;
 	bool paused;
+	int last_asteroid_id, last_ship_id; // ids handed out so far
 };
 
-template <typename T> void compile_diff(const std::vector<T> &old_list, const std::vector<T> &new_list, std::vector<const Entity*> &delta)
-{
-	for(const T &ent_new : new_list)
-	{
-		bool found = false;
-
-		for(const T &ent_old : old_list)
-		{
-			if(ent_new.id != ent_old.id)
-				continue;
-
-			found = true;
-			if(ent_new.diff(ent_old))
-				delta.push_back(&ent_new);
-		}
-
-		if(!found)
-			delta.push_back(&ent_new);
-	}
-}
-
-template <typename T> void compile_remove_diff(const Entity::Type ent_type, const std::vector<T> &old_list, const std::vector<T> &new_list, std::vector<Entity::Reference> &removed)
-{
-	for(const T &ent_old : old_list)
-	{
-		bool found = false;
-
-		for(const T &ent_new : new_list)
-		{
-			if(ent_old.id == ent_new.id)
-			{
-				found = true;
-				break;
-			}
-		}
-
-		if(!found)
-			removed.push_back({ent_type, ent_old.id});
-	}
-}
-
 #endif // GAMESTATE_H
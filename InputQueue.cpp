@@ -0,0 +1,109 @@
+#include <cmath>
+
+#include "InputQueue.h"
+
+InputQueue::InputQueue()
+	: next_step(0)
+	, newest(0)
+	, buffering(true)
+	, have_transit(false)
+	, last_transit(0)
+{}
+
+// queue up the frame for client input step <step>
+void InputQueue::push(std::uint32_t step, const Controls &controls)
+{
+	const bool fresh = step > newest;
+	if(fresh)
+		newest = step;
+
+	if(step < next_step)
+	{
+		// redundant copies of frames that were already played are expected, only count new ones
+		if(fresh)
+			++statistics.late;
+		return;
+	}
+
+	// keep it sorted, ignore duplicates (every frame shows up in several datagrams)
+	auto it = queue.begin();
+	while(it != queue.end() && (*it).step < step)
+		++it;
+	if(it != queue.end() && (*it).step == step)
+		return;
+
+	queue.insert(it, {step, controls});
+
+	if(queue.size() > INPUT_QUEUE_MAX * 2)
+	{
+		queue.pop_front();
+		++statistics.overruns;
+	}
+
+	statistics.depth = queue.size();
+}
+
+// note that a datagram with newest input step <client_step> arrived during server step <server_step>.
+// this is what the jitter estimate (and so the target depth) comes from
+void InputQueue::arrival(std::uint32_t client_step, std::uint32_t server_step)
+{
+	const int transit = (int)(server_step - client_step);
+
+	if(have_transit)
+	{
+		// rfc 3550 style smoothed jitter
+		const int d = std::abs(transit - last_transit);
+		statistics.jitter += (d - statistics.jitter) / 16.0f;
+	}
+
+	have_transit = true;
+	last_transit = transit;
+
+	const unsigned target = std::ceil(statistics.jitter * 2.0f) + 1;
+	statistics.target = target > INPUT_QUEUE_MAX ? INPUT_QUEUE_MAX : target;
+}
+
+// exactly one of these per Server::step
+Controls InputQueue::pop()
+{
+	if(buffering)
+	{
+		if(queue.size() < statistics.target)
+			return last;
+
+		buffering = false;
+	}
+
+	if(queue.empty())
+	{
+		// hold the last input and wait for the queue to fill back up
+		++statistics.underruns;
+		buffering = true;
+		return last;
+	}
+
+	// too far behind, drop the oldest frames to get latency back down.
+	// don't lose any trigger taps in the process
+	bool fire = false;
+	while(queue.size() > statistics.target + 2)
+	{
+		fire = fire || queue.front().controls.fire;
+		queue.pop_front();
+		++statistics.overruns;
+	}
+
+	const Frame frame = queue.front();
+	queue.pop_front();
+
+	next_step = frame.step + 1;
+	last = frame.controls;
+	last.fire = last.fire || fire;
+
+	statistics.depth = queue.size();
+	return last;
+}
+
+const InputQueue::Stats &InputQueue::stats() const
+{
+	return statistics;
+}
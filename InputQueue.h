@@ -0,0 +1,60 @@
+#ifndef INPUTQUEUE_H
+#define INPUTQUEUE_H
+
+#include <deque>
+#include <cstdint>
+
+#include "GameState.h"
+
+#define INPUT_QUEUE_MAX 8 // most frames the queue will buffer before it starts dropping the oldest
+
+// per-client input jitter buffer.
+// frames are keyed by client input step and handed out exactly one per Server::step.
+// the depth it waits for before playing adapts to how unevenly the client's datagrams arrive
+class InputQueue
+{
+public:
+	struct Stats
+	{
+		Stats()
+			: depth(0)
+			, target(1)
+			, jitter(0.0f)
+			, underruns(0)
+			, overruns(0)
+			, late(0)
+		{}
+
+		unsigned depth; // frames currently waiting
+		unsigned target; // depth the queue is trying to keep
+		float jitter; // smoothed arrival jitter, in server steps
+		unsigned underruns; // steps that had no frame to hand out
+		unsigned overruns; // frames dropped because the queue got too deep
+		unsigned late; // frames that arrived after their step was already played
+	};
+
+	InputQueue();
+
+	void push(std::uint32_t, const Controls&);
+	void arrival(std::uint32_t, std::uint32_t);
+	Controls pop();
+	const Stats &stats() const;
+
+private:
+	struct Frame
+	{
+		std::uint32_t step;
+		Controls controls;
+	};
+
+	std::deque<Frame> queue;
+	Controls last;
+	std::uint32_t next_step; // client step of the next frame to be played
+	std::uint32_t newest; // newest client step ever pushed
+	bool buffering;
+	bool have_transit;
+	int last_transit;
+	Stats statistics;
+};
+
+#endif // INPUTQUEUE_H
@@ -7,15 +7,17 @@
 #include <string.h>
 
 #include "stbsrisrates.h"
+#include "network.h"
 #include "GameState.h"
 
 namespace lmp
 {
 	enum class Type : std::uint8_t;
+	struct Traffic;
 
 	struct netbuf
 	{
-		netbuf() : offset(0), size(0) {}
+		netbuf(Traffic *t = NULL) : offset(0), size(0), overrun(false), traffic(t) {}
 		~netbuf()
 		{
 			if(size > 0 && offset != size)
@@ -29,12 +31,14 @@ namespace lmp
 		{
 			size = 0;
 			offset = 0;
+			overrun = false;
 		}
 
 		static bool get(netbuf &buf, net::udp_server &udp, net::udp_id &id)
 		{
 			buf.reset();
 			buf.size = udp.recv(buf.raw.data(), buf.raw.size(), id);
+			buf.received();
 			return buf.size > 0;
 		}
 
@@ -42,37 +46,180 @@ namespace lmp
 		{
 			buf.reset();
 			buf.size = udp.recv(buf.raw.data(), buf.raw.size());
+			buf.received();
 			return buf.size > 0;
 		}
 
 		template <typename T> void push(const T &lump)
 		{
+			const unsigned before = size;
 			lump.serialize(*this);
+			count(lump.type, size - before);
 		}
 
-		template <typename T> const T *pop()
+		// decode the next lump into <lump>, if it's a T.
+		// nothing is shared between calls, so separate netbufs can be popped from on separate threads.
+		// false if the next lump isn't a T or runs off the end of the datagram
+		template <typename T> bool pop(T &lump)
 		{
 			if(offset >= size)
-				return NULL;
-
-			static T static_lump;
+				return false;
 
 			// read type
 			Type type;
 			memcpy(&type, raw.data() + offset, sizeof(type));
 
-			if(type != static_lump.type)
-				return NULL;
+			if(type != lump.type)
+				return false;
 
+			const unsigned before = offset;
 			offset += sizeof(type);
-			static_lump.deserialize(*this);
+			lump.deserialize(*this);
+			if(overrun)
+				return false;
 
-			return &static_lump;
+			count(type, offset - before);
+			return true;
 		}
 
 		std::array<std::uint8_t, MAX_DATAGRAM_SIZE> raw;
 		unsigned offset;
 		unsigned size;
+		bool overrun; // a lump ran off the end of what was received
+		Traffic *traffic; // lumps pushed and popped are counted here, if it's set
+
+	private:
+		void count(Type, unsigned);
+		void received();
+	};
+
+	// bit level writer and reader for the packed parts of a datagram
+	struct bitwriter
+	{
+		bitwriter(std::uint8_t *buf, unsigned cap)
+			: buffer(buf)
+			, capacity(cap)
+			, count(0)
+		{
+			memset(buffer, 0, capacity);
+		}
+
+		void write(std::uint32_t value, int bits)
+		{
+			if(count + bits > capacity * 8)
+				hcf("buffer overwrite when bit packing");
+
+			for(int i = bits - 1; i >= 0; --i)
+			{
+				if((value >> i) & 1)
+					buffer[count / 8] |= 128 >> (count % 8);
+				++count;
+			}
+		}
+
+		// exp-golomb, small values are cheap
+		void write_unsigned(std::uint32_t value)
+		{
+			const std::uint64_t v = std::uint64_t(value) + 1;
+			int len = 0;
+			while((v >> len) > 1)
+				++len;
+
+			write(0, len);
+			write(v >> 32, len >= 32 ? 1 : 0);
+			write(v, len >= 32 ? 32 : len + 1);
+		}
+
+		void write_signed(std::int32_t value)
+		{
+			write_unsigned(value > 0 ? (std::uint32_t(value) * 2) - 1 : std::uint32_t(-std::int64_t(value)) * 2);
+		}
+
+		// what write_unsigned() and write_signed() will cost
+		static int unsigned_bits(std::uint32_t value)
+		{
+			const std::uint64_t v = std::uint64_t(value) + 1;
+			int len = 0;
+			while((v >> len) > 1)
+				++len;
+
+			return (len * 2) + 1;
+		}
+
+		static int signed_bits(std::int32_t value)
+		{
+			return unsigned_bits(value > 0 ? (std::uint32_t(value) * 2) - 1 : std::uint32_t(-std::int64_t(value)) * 2);
+		}
+
+		unsigned bits() const { return count; }
+		unsigned bytes() const { return (count + 7) / 8; }
+		unsigned room() const { return (capacity * 8) - count; } // in bits
+
+	private:
+		std::uint8_t *const buffer;
+		const unsigned capacity; // in bytes
+		unsigned count; // bits written
+	};
+
+	// reading past the end never crashes, it just sets <overrun>
+	struct bitreader
+	{
+		bitreader(const std::uint8_t *buf, unsigned len)
+			: overrun(false)
+			, buffer(buf)
+			, length(len)
+			, count(0)
+		{}
+
+		std::uint32_t read(int bits)
+		{
+			std::uint32_t value = 0;
+			for(int i = 0; i < bits; ++i)
+			{
+				if(count >= length * 8)
+				{
+					overrun = true;
+					return 0;
+				}
+
+				value = (value << 1) | ((buffer[count / 8] >> (7 - (count % 8))) & 1);
+				++count;
+			}
+
+			return value;
+		}
+
+		std::uint32_t read_unsigned()
+		{
+			int len = 0;
+			while(read(1) == 0)
+			{
+				if(overrun || ++len > 32)
+				{
+					overrun = true;
+					return 0;
+				}
+			}
+
+			std::uint64_t v = 1;
+			for(int i = 0; i < len; ++i)
+				v = (v << 1) | read(1);
+
+			return v - 1;
+		}
+
+		std::int32_t read_signed()
+		{
+			const std::uint32_t v = read_unsigned();
+			return (v & 1) ? std::int32_t((v + 1) / 2) : -std::int32_t(v / 2);
+		}
+
+		bool overrun;
+
+	private:
+		const std::uint8_t *const buffer;
+		const unsigned length; // in bytes
+		unsigned count; // bits read
 	};
 
 	struct Lump
@@ -96,15 +243,46 @@ namespace lmp
 			nbuf.size += len;
 		}
 
+		// a short datagram leaves the rest of the lump zeroed and the netbuf marked, instead of reading stale bytes
 		template <typename T> void read(T &subject, netbuf &nbuf)
 		{
 			const unsigned len = sizeof(subject);
-			if(nbuf.offset + len > nbuf.raw.size())
-				hcf("buffer overread when deserializing");
+			if(nbuf.offset + len > nbuf.size)
+			{
+				memset(&subject, 0, len);
+				nbuf.offset = nbuf.size;
+				nbuf.overrun = true;
+				return;
+			}
 
 			memcpy(&subject, nbuf.raw.data() + nbuf.offset, len);
 			nbuf.offset += len;
 		}
+
+		void write_bytes(const std::uint8_t *subject, unsigned len, netbuf &nbuf) const
+		{
+			if(nbuf.offset + len > nbuf.raw.size())
+				hcf("buffer overwrite when serializing");
+
+			memcpy(nbuf.raw.data() + nbuf.offset, subject, len);
+			nbuf.offset += len;
+			nbuf.size += len;
+		}
+
+		// <len> bytes in place, NULL if the datagram is too short
+		const std::uint8_t *view_bytes(unsigned len, netbuf &nbuf)
+		{
+			if(nbuf.offset + len > nbuf.size)
+			{
+				nbuf.offset = nbuf.size;
+				nbuf.overrun = true;
+				return NULL;
+			}
+
+			const std::uint8_t *const bytes = nbuf.raw.data() + nbuf.offset;
+			nbuf.offset += len;
+			return bytes;
+		}
 	};
 
 	// *********************
@@ -123,106 +301,475 @@ namespace lmp
 		PLAYER,
 		ASTEROID,
 		SHIP,
-		REMOVE
+		REMOVE,
+		JOIN_REQUEST,
+		JOIN_REPLY,
+		DELTA,
+		LOCKSTEP,
+		CHECKSUM
+	};
+
+	inline const char *name(Type type)
+	{
+		switch(type)
+		{
+			case Type::CLIENT_INFO: return "client info";
+			case Type::SERVER_INFO: return "server info";
+			case Type::PLAYER: return "player";
+			case Type::ASTEROID: return "asteroid";
+			case Type::SHIP: return "ship";
+			case Type::REMOVE: return "remove";
+			case Type::JOIN_REQUEST: return "join request";
+			case Type::JOIN_REPLY: return "join reply";
+			case Type::DELTA: return "delta";
+			case Type::LOCKSTEP: return "lockstep";
+			case Type::CHECKSUM: return "checksum";
+		}
+
+		return "unknown";
+	}
+
+	// lumps and bytes by lump type, and whole datagrams, going one way.
+	// plain counters, cheap enough to always keep
+	struct Traffic
+	{
+		static constexpr int TYPES = (int)Type::CHECKSUM + 1;
+
+		Traffic()
+			: lumps{}
+			, bytes{}
+			, datagrams(0)
+			, total(0)
+		{}
+
+		void lump(Type type, unsigned size)
+		{
+			if((int)type >= TYPES)
+				return;
+
+			++lumps[(int)type];
+			bytes[(int)type] += size;
+		}
+
+		void datagram(unsigned size)
+		{
+			++datagrams;
+			total += size;
+		}
+
+		void operator+=(const Traffic &rhs)
+		{
+			for(int i = 0; i < TYPES; ++i)
+			{
+				lumps[i] += rhs.lumps[i];
+				bytes[i] += rhs.bytes[i];
+			}
+
+			datagrams += rhs.datagrams;
+			total += rhs.total;
+		}
+
+		unsigned lumps[TYPES]; // indexed by lmp::Type
+		unsigned long long bytes[TYPES];
+		unsigned datagrams;
+		unsigned long long total; // bytes in whole datagrams
 	};
 
+	inline void netbuf::count(Type type, unsigned bytes)
+	{
+		if(traffic != NULL)
+			traffic->lump(type, bytes);
+	}
+
+	inline void netbuf::received()
+	{
+		if(traffic != NULL && size > 0)
+			traffic->datagram(size);
+	}
+
+	// every ClientInfo repeats the last few input frames, so one lost datagram doesn't lose any input.
+	// the newest frame is sent in full, each older one as a delta against the frame after it
 	struct ClientInfo : Lump
 	{
-		ClientInfo() : Lump(Type::CLIENT_INFO) {}
+		struct Frame
+		{
+			Frame() : x(0.0f), y(0.0f), fire(0), angle(0.0f) {}
+
+			float x;
+			float y;
+			std::uint8_t fire;
+			float angle;
+		};
+
+		ClientInfo() : Lump(Type::CLIENT_INFO), clock(0), frame_count(0) {}
 
 		void serialize(netbuf &nbuf) const
 		{
+			if(frame_count < 1 || frame_count > INPUT_HISTORY)
+				hcf("invalid input frame count %d", frame_count);
+
 			std::uint8_t bits = 0;
-			bits |= fire << 0;
+			bits |= frames[0].fire << 0;
 			bits |= paused << 1;
-
-			std::int8_t int_x = x * 100, int_y = y * 100;
+			bits |= frame_count << 2;
 
 			write(type, nbuf);
 
 			write(secret, nbuf);
 			write(stepno, nbuf);
-			write(int_x, nbuf);
-			write(int_y, nbuf);
+			write(input_step, nbuf);
+			write(clock, nbuf);
 			write(bits, nbuf);
-			write(angle, nbuf);
+			write(quantize_axis(frames[0].x), nbuf);
+			write(quantize_axis(frames[0].y), nbuf);
+			write(quantize_angle(frames[0].angle), nbuf);
+
+			for(int i = 1; i < frame_count; ++i)
+			{
+				const Frame &newer = frames[i - 1];
+				const Frame &frame = frames[i];
+
+				const bool x_changed = quantize_axis(frame.x) != quantize_axis(newer.x);
+				const bool y_changed = quantize_axis(frame.y) != quantize_axis(newer.y);
+				const bool angle_changed = quantize_angle(frame.angle) != quantize_angle(newer.angle);
+
+				std::uint8_t mask = 0;
+				mask |= x_changed << 0;
+				mask |= y_changed << 1;
+				mask |= angle_changed << 2;
+				mask |= frame.fire << 3;
+
+				write(mask, nbuf);
+				if(x_changed)
+					write(quantize_axis(frame.x), nbuf);
+				if(y_changed)
+					write(quantize_axis(frame.y), nbuf);
+				if(angle_changed)
+					write(quantize_angle(frame.angle), nbuf);
+			}
 		}
 
 		void deserialize(netbuf &nbuf)
 		{
 			std::uint8_t bits = 0;
-
 			std::int8_t int_x, int_y;
+			std::int16_t int_angle;
 
 			read(secret, nbuf);
 			read(stepno, nbuf);
+			read(input_step, nbuf);
+			read(clock, nbuf);
+			read(bits, nbuf);
 			read(int_x, nbuf);
 			read(int_y, nbuf);
-			read(bits, nbuf);
-			read(angle, nbuf);
+			read(int_angle, nbuf);
 
-			fire = (bits >> 0) & 1;
+			frames[0].fire = (bits >> 0) & 1;
 			paused = (bits >> 1) & 1;
-			x = int_x / 100.0;
-			y = int_y / 100.0;
+			frame_count = bits >> 2;
+			frames[0].x = axis(int_x);
+			frames[0].y = axis(int_y);
+			frames[0].angle = angle(int_angle);
+
+			if(frame_count < 1 || frame_count > INPUT_HISTORY)
+			{
+				// garbage, don't trust anything past the newest frame
+				frame_count = 1;
+				return;
+			}
+
+			for(int i = 1; i < frame_count; ++i)
+			{
+				std::uint8_t mask;
+				read(mask, nbuf);
+
+				frames[i] = frames[i - 1];
+				frames[i].fire = (mask >> 3) & 1;
+				if(mask & 1)
+				{
+					read(int_x, nbuf);
+					frames[i].x = axis(int_x);
+				}
+				if(mask & 2)
+				{
+					read(int_y, nbuf);
+					frames[i].y = axis(int_y);
+				}
+				if(mask & 4)
+				{
+					read(int_angle, nbuf);
+					frames[i].angle = angle(int_angle);
+				}
+			}
 		}
 
+		static std::int8_t quantize_axis(float f) { return f * 100; }
+		static std::int16_t quantize_angle(float f) { return f * ANGLE_SCALE; }
+		static float axis(std::int8_t q) { return q / 100.0; }
+		static float angle(std::int16_t q) { return q / ANGLE_SCALE; }
+		static constexpr float ANGLE_SCALE = 32767.0f / 3.1415927f;
+
 		std::uint32_t stepno;
 		std::int32_t secret;
-		float x;
-		float y;
-		std::uint8_t fire, paused;
-		float angle;
+		std::uint32_t input_step; // client input step of frames[0]. frames[i] is from input_step - i
+		std::uint16_t clock; // the client's milliseconds() when it sent this, for the server to echo back
+		std::uint8_t paused;
+		std::uint8_t frame_count;
+		Frame frames[INPUT_HISTORY];
 	};
 
+	// per-client header of every server datagram.
+	// anything that can be taken from the client's baseline snapshot is left out when it hasn't changed
 	struct ServerInfo : Lump
 	{
-		ServerInfo() : Lump(Type::SERVER_INFO) {}
+		ServerInfo() : Lump(Type::SERVER_INFO), baseline(0), has_id(0), has_repair(0), has_score(0), has_echo(0) {}
 
 		void serialize(netbuf &nbuf) const
 		{
-			std::uint8_t normal_win = !!win;
-			std::uint8_t normal_pause = !!paused;
-
-			std::uint32_t win_and_stepno = normal_win << 31;
+			std::uint32_t win_and_stepno = std::uint32_t(!!win) << 31;
 			win_and_stepno |= stepno;
 
-			std::uint8_t pause_and_repair = normal_pause << 7;
-			pause_and_repair |= repair;
+			std::uint8_t flags = 0;
+			flags |= (!!paused) << 0;
+			flags |= (!!has_id) << 1;
+			flags |= (!!has_repair) << 2;
+			flags |= (!!has_score) << 3;
+			flags |= (!!has_echo) << 4;
 
 			write(type, nbuf);
 
 			write(win_and_stepno, nbuf);
-			write(my_id, nbuf);
-			write(pause_and_repair, nbuf);
-			write(score, nbuf);
+			write(baseline, nbuf);
+			write(flags, nbuf);
+			if(has_id)
+			{
+				write(my_id, nbuf);
+				write(world_width, nbuf);
+				write(world_height, nbuf);
+				write(tick, nbuf);
+			}
+			if(has_repair)
+				write(repair, nbuf);
+			if(has_score)
+				write(score, nbuf);
+			if(has_echo)
+			{
+				write(echo, nbuf);
+				write(hold, nbuf);
+			}
 		}
 
 		void deserialize(netbuf &nbuf)
 		{
 			std::uint32_t win_and_stepno;
-			std::uint8_t pause_and_repair;
+			std::uint8_t flags;
 
 			read(win_and_stepno, nbuf);
-			read(my_id, nbuf);
-			read(pause_and_repair, nbuf);
-			read(score, nbuf);
-
-			paused = (pause_and_repair & 128) == 128;
-			repair = pause_and_repair & 127;
+			read(baseline, nbuf);
+			read(flags, nbuf);
+
+			paused = (flags >> 0) & 1;
+			has_id = (flags >> 1) & 1;
+			has_repair = (flags >> 2) & 1;
+			has_score = (flags >> 3) & 1;
+			has_echo = (flags >> 4) & 1;
+
+			if(has_id)
+			{
+				read(my_id, nbuf);
+				read(world_width, nbuf);
+				read(world_height, nbuf);
+				read(tick, nbuf);
+			}
+			if(has_repair)
+				read(repair, nbuf);
+			else
+				repair = 0;
+			if(has_score)
+				read(score, nbuf);
+			if(has_echo)
+			{
+				read(echo, nbuf);
+				read(hold, nbuf);
+			}
 
 			win = ((win_and_stepno >> 31) & 1) == 1;
 			stepno = win_and_stepno & 2147483647;
 		}
 
 		std::uint32_t stepno;
+		std::uint8_t baseline; // how many steps back the baseline snapshot is. 0 means no baseline
 		std::uint8_t my_id;
+		std::int32_t world_width, world_height; // sent along with my_id
+		std::uint8_t tick; // simulation steps per second, sent along with my_id
 		std::uint8_t repair;
 		std::uint8_t paused;
 		std::uint8_t win;
 		std::int32_t score;
+		std::uint16_t echo; // ClientInfo::clock of the newest one the server has from this client...
+		std::uint16_t hold; // ...and the milliseconds between that arriving and this going out. see ClockSync
+		std::uint8_t has_id, has_repair, has_score, has_echo;
+	};
+
+	// bit packed entity changes against the baseline snapshot. see Snapshot.h.
+	// the payload isn't copied: going out it's the encoder's buffer, coming in it's a view into the netbuf,
+	// good until that netbuf is reset or refilled
+	struct Delta : Lump
+	{
+		Delta() : Lump(Type::DELTA), length(0), payload(NULL) {}
+
+		void serialize(netbuf &nbuf) const
+		{
+			write(type, nbuf);
+
+			write(length, nbuf);
+			write_bytes(payload, length, nbuf);
+		}
+
+		void deserialize(netbuf &nbuf)
+		{
+			read(length, nbuf);
+			payload = view_bytes(length, nbuf);
+			if(payload == NULL)
+				length = 0;
+		}
+
+		std::uint16_t length;
+		const std::uint8_t *payload;
+	};
+
+	// follows a Delta now and then: Snapshot::checksum of what the client should have after decoding it.
+	// anything else means the encoder and decoder (or their predictions) have drifted apart
+	struct Checksum : Lump
+	{
+		Checksum() : Lump(Type::CHECKSUM), value(0) {}
+
+		void serialize(netbuf &nbuf) const
+		{
+			write(type, nbuf);
+
+			write(value, nbuf);
+		}
+
+		void deserialize(netbuf &nbuf)
+		{
+			read(value, nbuf);
+		}
+
+		std::uint32_t value;
+	};
+
+	// lockstep mode: the inputs every client needs to run the match itself, in place of a Delta.
+	// the match started at step <start> with fresh players for <roster>, and <ticks> are steps <first> on.
+	// <checksum> is GameState::checksum() of the server's state at step <checksum_step>, 0 for none yet
+	struct Lockstep : Lump
+	{
+		struct Input
+		{
+			std::int8_t x, y;
+			std::int16_t angle;
+		};
+
+		struct Tick
+		{
+			std::uint8_t bits; // paused, then fire for each player
+			Input inputs[MAX_PLAYERS];
+		};
+
+		Lockstep() : Lump(Type::LOCKSTEP), player_count(0), tick_count(0) {}
+
+		void serialize(netbuf &nbuf) const
+		{
+			write(type, nbuf);
+
+			write(start, nbuf);
+			write(seed, nbuf);
+			write(checksum_step, nbuf);
+			write(checksum, nbuf);
+			write(player_count, nbuf);
+			for(int i = 0; i < player_count; ++i)
+				write(roster[i], nbuf);
+
+			write(first, nbuf);
+			write(tick_count, nbuf);
+			for(int i = 0; i < tick_count; ++i)
+			{
+				write(ticks[i].bits, nbuf);
+				for(int j = 0; j < player_count; ++j)
+				{
+					write(ticks[i].inputs[j].x, nbuf);
+					write(ticks[i].inputs[j].y, nbuf);
+					write(ticks[i].inputs[j].angle, nbuf);
+				}
+			}
+		}
+
+		void deserialize(netbuf &nbuf)
+		{
+			read(start, nbuf);
+			read(seed, nbuf);
+			read(checksum_step, nbuf);
+			read(checksum, nbuf);
+			read(player_count, nbuf);
+			if(player_count > MAX_PLAYERS)
+			{
+				nbuf.offset = nbuf.size;
+				nbuf.overrun = true;
+				return;
+			}
+			for(int i = 0; i < player_count; ++i)
+				read(roster[i], nbuf);
+
+			read(first, nbuf);
+			read(tick_count, nbuf);
+			if(tick_count > LOCKSTEP_TICKS)
+			{
+				nbuf.offset = nbuf.size;
+				nbuf.overrun = true;
+				return;
+			}
+			for(int i = 0; i < tick_count; ++i)
+			{
+				read(ticks[i].bits, nbuf);
+				for(int j = 0; j < player_count; ++j)
+				{
+					read(ticks[i].inputs[j].x, nbuf);
+					read(ticks[i].inputs[j].y, nbuf);
+					read(ticks[i].inputs[j].angle, nbuf);
+				}
+			}
+		}
+
+		// what the server plays, exactly as the clients will get it
+		static Input quantize(const Controls &controls)
+		{
+			return { ClientInfo::quantize_axis(controls.x), ClientInfo::quantize_axis(controls.y), ClientInfo::quantize_angle(controls.angle) };
+		}
+
+		static Controls controls(const Tick &tick, int player)
+		{
+			Controls c;
+			c.x = ClientInfo::axis(tick.inputs[player].x);
+			c.y = ClientInfo::axis(tick.inputs[player].y);
+			c.angle = ClientInfo::angle(tick.inputs[player].angle);
+			c.fire = (tick.bits >> (player + 1)) & 1;
+			return c;
+		}
+
+		std::uint32_t start;
+		std::uint64_t seed;
+		std::uint32_t checksum_step;
+		std::uint32_t checksum;
+		std::uint8_t player_count;
+		std::int32_t roster[MAX_PLAYERS];
+		std::uint32_t first;
+		std::uint8_t tick_count;
+		Tick ticks[LOCKSTEP_TICKS];
 	};
 
+	// the lumps below are the old one-lump-per-entity format.
+	// they don't go out on the wire anymore, the server only sizes them for its bandwidth report
+
 	struct Player : Lump
 	{
 		Player() : Lump(Type::PLAYER) {}
@@ -398,6 +945,61 @@ namespace lmp
 
 		Entity::Reference ref;
 	};
+
+	// udp-only join handshake.
+	// the request is padded so that it is never smaller than the reply, so the server can't be used as an amplifier
+	struct JoinRequest : Lump
+	{
+		JoinRequest() : Lump(Type::JOIN_REQUEST), spectate(0) {}
+
+		void serialize(netbuf &nbuf) const
+		{
+			const std::uint64_t padding = 0;
+
+			write(type, nbuf);
+
+			write(nonce, nbuf);
+			write(spectate, nbuf);
+			write(padding, nbuf);
+		}
+
+		void deserialize(netbuf &nbuf)
+		{
+			std::uint64_t padding;
+
+			read(nonce, nbuf);
+			read(spectate, nbuf);
+			read(padding, nbuf);
+		}
+
+		std::uint32_t nonce;
+		std::uint8_t spectate; // 1 to watch without playing
+	};
+
+	struct JoinReply : Lump
+	{
+		JoinReply() : Lump(Type::JOIN_REPLY) {}
+
+		void serialize(netbuf &nbuf) const
+		{
+			write(type, nbuf);
+
+			write(nonce, nbuf);
+			write(accepted, nbuf);
+			write(secret, nbuf);
+		}
+
+		void deserialize(netbuf &nbuf)
+		{
+			read(nonce, nbuf);
+			read(accepted, nbuf);
+			read(secret, nbuf);
+		}
+
+		std::uint32_t nonce;
+		std::uint8_t accepted;
+		std::int32_t secret;
+	};
 }
 
 #endif // LUMP_H
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <QAudioDeviceInfo>
+#include <QAudioFormat>
+#include <QAudioOutput>
+#include <QFile>
+#include <QTimer>
+
+#include "Mixer.h"
+
+// 16 bit pcm, mono or stereo, at MIXER_RATE. anything else is turned down
+static bool decode_wav(const QByteArray &data, std::vector<std::int16_t> &pcm)
+{
+	const char *const bytes = data.constData();
+	const unsigned size = data.size();
+	if(size < 12 || memcmp(bytes, "RIFF", 4) || memcmp(bytes + 8, "WAVE", 4))
+		return false;
+
+	std::uint16_t format = 0, channels = 0, bits = 0;
+	std::uint32_t rate = 0;
+	for(unsigned at = 12; at + 8 <= size;)
+	{
+		const char *const chunk = bytes + at;
+		std::uint32_t length;
+		memcpy(&length, chunk + 4, sizeof(length));
+		if(length > size - at - 8)
+			return false;
+
+		if(!memcmp(chunk, "fmt ", 4) && length >= 16)
+		{
+			memcpy(&format, chunk + 8, sizeof(format));
+			memcpy(&channels, chunk + 10, sizeof(channels));
+			memcpy(&rate, chunk + 12, sizeof(rate));
+			memcpy(&bits, chunk + 22, sizeof(bits));
+		}
+		else if(!memcmp(chunk, "data", 4))
+		{
+			if(format != 1 || bits != 16 || rate != MIXER_RATE || channels < 1 || channels > 2)
+				return false;
+
+			// down to mono, it's panned at play time
+			pcm.resize(length / (2 * channels));
+			for(unsigned i = 0; i < pcm.size(); ++i)
+			{
+				int sum = 0;
+				for(int c = 0; c < channels; ++c)
+				{
+					std::int16_t sample;
+					memcpy(&sample, chunk + 8 + (((i * channels) + c) * 2), sizeof(sample));
+					sum += sample;
+				}
+				pcm[i] = sum / channels;
+			}
+
+			return true;
+		}
+
+		at += 8 + length + (length & 1);
+	}
+
+	return false;
+}
+
+// stand-ins for when there's no wav, so the effects work out of the box
+static std::vector<std::int16_t> synthesize(Sound::Effect effect)
+{
+	// seconds, decay per second, noise smoothing (0 for a tone), gain
+	const struct { float length, decay, smoothing, gain; } recipes[Sound::EFFECT_COUNT] =
+	{
+		{ 0.08f, 30.0f, 0.0f, 0.15f }, // SHOT
+		{ 0.05f, 80.0f, 0.6f, 0.4f }, // HIT
+		{ 0.6f, 7.0f, 0.1f, 1.6f }, // EXPLOSION
+		{ 1.5f, 2.5f, 0.04f, 2.5f } // BLAST
+	};
+	const auto &recipe = recipes[effect];
+
+	std::mt19937 random(effect + 1);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	std::vector<std::int16_t> pcm(recipe.length * MIXER_RATE);
+	float phase = 0.0f, low = 0.0f;
+	for(unsigned i = 0; i < pcm.size(); ++i)
+	{
+		const float t = (float)i / MIXER_RATE;
+		float sample;
+		if(recipe.smoothing == 0.0f)
+		{
+			// falling square wave
+			phase += (1400.0f - ((t / recipe.length) * 1000.0f)) / MIXER_RATE;
+			sample = phase - std::floor(phase) < 0.5f ? 1.0f : -1.0f;
+		}
+		else
+		{
+			low += (noise(random) - low) * recipe.smoothing;
+			sample = low;
+		}
+
+		const float scaled = sample * std::exp(-t * recipe.decay) * recipe.gain * 32767.0f;
+		pcm[i] = std::min(std::max(scaled, -32768.0f), 32767.0f);
+	}
+
+	return pcm;
+}
+
+Mixer::Mixer()
+	: head(0)
+	, tail(0)
+	, dropped(0)
+	, output(NULL)
+	, device(NULL)
+	, timer(NULL)
+	, latency_sum(0.0)
+	, second(std::chrono::steady_clock::now())
+{
+	load(Sound::SHOT, "shot");
+	load(Sound::HIT, "hit");
+	load(Sound::EXPLOSION, "explosion");
+	load(Sound::BLAST, "blast");
+
+	context.moveToThread(&thread);
+	thread.start(QThread::TimeCriticalPriority);
+	QMetaObject::invokeMethod(&context, [this]() { open(); });
+}
+
+Mixer::~Mixer()
+{
+	QMetaObject::invokeMethod(&context, [this]() { close(); }, Qt::BlockingQueuedConnection);
+	thread.quit();
+	thread.wait();
+}
+
+// from the game thread. <volume> from 0 to 1, <pan> from -1 (left) to 1 (right)
+void Mixer::play(Sound::Effect effect, float volume, float pan)
+{
+	const unsigned at = tail.load(std::memory_order_relaxed);
+	if(at - head.load(std::memory_order_acquire) >= MIXER_QUEUE)
+	{
+		++dropped;
+		return;
+	}
+
+	queue[at % MIXER_QUEUE] = {effect, volume, pan, std::chrono::steady_clock::now()};
+	tail.store(at + 1, std::memory_order_release);
+}
+
+Mixer::Stats Mixer::stats() const
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+
+	return last_second;
+}
+
+// assets/sfx/effects/<name>.wav, or a made up one
+void Mixer::load(Sound::Effect effect, const char *name)
+{
+	QFile file(QString("assets/sfx/effects/") + name + ".wav");
+	if(file.open(QIODevice::ReadOnly) && decode_wav(file.readAll(), samples[effect]))
+		return;
+
+	if(file.exists())
+		lprintf("mixer: %s isn't 16 bit pcm at %d Hz, using a stand-in", file.fileName().toStdString().c_str(), MIXER_RATE);
+	samples[effect] = synthesize(effect);
+}
+
+// on the mixer thread
+void Mixer::open()
+{
+	QAudioFormat format;
+	format.setSampleRate(MIXER_RATE);
+	format.setChannelCount(2);
+	format.setSampleSize(16);
+	format.setCodec("audio/pcm");
+	format.setByteOrder(QAudioFormat::LittleEndian);
+	format.setSampleType(QAudioFormat::SignedInt);
+
+	if(!QAudioDeviceInfo::defaultOutputDevice().isFormatSupported(format))
+	{
+		lprintf("mixer: no output takes 16 bit stereo at %d Hz, no sound effects", MIXER_RATE);
+		return;
+	}
+
+	output = new QAudioOutput(format);
+	output->setBufferSize((MIXER_RATE * 4 * MIXER_BUFFER) / 1000);
+	device = output->start();
+	if(device == NULL || output->error() != QAudio::NoError)
+	{
+		lprintf("mixer: could not start the output, no sound effects");
+		close();
+		return;
+	}
+
+	timer = new QTimer;
+	timer->setTimerType(Qt::PreciseTimer);
+	QObject::connect(timer, &QTimer::timeout, &context, [this]() { pump(); });
+	timer->start(MIXER_PERIOD);
+}
+
+// on the mixer thread
+void Mixer::close()
+{
+	delete timer;
+	timer = NULL;
+
+	if(output != NULL)
+		output->stop();
+	delete output;
+	output = NULL;
+	device = NULL;
+}
+
+// on the mixer thread: start what's been played since last time, and top the output back up
+void Mixer::pump()
+{
+	const int frames = output->bytesFree() / 4;
+	const float buffered = ((output->bufferSize() / 4) - frames) * 1000.0f / MIXER_RATE; // ahead of what's written now
+
+	const unsigned end = tail.load(std::memory_order_acquire);
+	unsigned at = head.load(std::memory_order_relaxed);
+	for(; at != end; ++at)
+		start(queue[at % MIXER_QUEUE], buffered);
+	head.store(at, std::memory_order_release);
+
+	if(frames > 0)
+	{
+		mix(frames);
+		device->write((const char*)out.data(), frames * 4);
+	}
+
+	const auto now = std::chrono::steady_clock::now();
+	if(now - second >= std::chrono::seconds(1))
+	{
+		counting.average = counting.events > 0 ? latency_sum / counting.events : 0.0f;
+		counting.dropped = dropped.exchange(0);
+		if(counting.worst > MIXER_TARGET_LATENCY)
+			lprintf("mixer: effects took up to %.1f ms to sound", counting.worst);
+
+		{
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			last_second = counting;
+		}
+
+		counting = Stats();
+		latency_sum = 0.0;
+		second = now;
+	}
+}
+
+// give <event> a voice. <buffered> is how many milliseconds of audio are queued up ahead of it.
+// what the driver holds past QAudioOutput's buffer isn't counted
+void Mixer::start(const Event &event, float buffered)
+{
+	const std::chrono::duration<float, std::milli> waited = std::chrono::steady_clock::now() - event.posted;
+	const float latency = waited.count() + buffered;
+	++counting.events;
+	latency_sum += latency;
+	counting.worst = std::max(counting.worst, latency);
+
+	// a free voice, or else the one that's been going longest
+	Voice *voice = &voices[0];
+	for(Voice &v : voices)
+	{
+		if(v.samples == NULL)
+		{
+			voice = &v;
+			break;
+		}
+
+		if(v.position > voice->position)
+			voice = &v;
+	}
+
+	// equal power pan
+	const float angle = (std::min(std::max(event.pan, -1.0f), 1.0f) + 1.0f) * 0.25f * 3.1415926f;
+	voice->samples = &samples[event.effect];
+	voice->position = 0;
+	voice->left = event.volume * std::cos(angle);
+	voice->right = event.volume * std::sin(angle);
+}
+
+// <frames> of every voice added up into <out>
+void Mixer::mix(unsigned frames)
+{
+	accumulator.assign(frames * 2, 0.0f);
+	for(Voice &voice : voices)
+	{
+		if(voice.samples == NULL)
+			continue;
+
+		const std::vector<std::int16_t> &pcm = *voice.samples;
+		const unsigned count = std::min<unsigned>(frames, pcm.size() - voice.position);
+		for(unsigned i = 0; i < count; ++i)
+		{
+			const float sample = pcm[voice.position + i];
+			accumulator[i * 2] += sample * voice.left;
+			accumulator[(i * 2) + 1] += sample * voice.right;
+		}
+
+		voice.position += count;
+		if(voice.position >= pcm.size())
+			voice.samples = NULL;
+	}
+
+	out.resize(frames * 2);
+	for(unsigned i = 0; i < out.size(); ++i)
+		out[i] = std::min(std::max(accumulator[i], -32768.0f), 32767.0f);
+}
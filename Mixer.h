@@ -0,0 +1,104 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <QObject>
+#include <QThread>
+
+#include "GameState.h"
+
+class QAudioOutput;
+class QIODevice;
+class QTimer;
+
+#define MIXER_RATE 44100 // frames per second, 16 bit stereo
+#define MIXER_VOICES 16 // effects that can sound at once. past that the oldest is cut off
+#define MIXER_QUEUE 64 // effects waiting for the mixer thread, a power of two
+#define MIXER_PERIOD 2 // milliseconds between top ups of the output
+#define MIXER_BUFFER 10 // milliseconds of audio the output holds
+#define MIXER_TARGET_LATENCY 20.0f // milliseconds from play() to the speaker we want to stay under
+
+// sound effects, next to the music in Sfx.
+// the effects are decoded (or made up) once at startup. play() puts them on a lock free queue for the mixer thread,
+// which keeps a short QAudioOutput push buffer topped up from a fixed pool of voices
+class Mixer
+{
+public:
+	// over the last full second
+	struct Stats
+	{
+		Stats()
+			: events(0)
+			, dropped(0)
+			, average(0.0f)
+			, worst(0.0f)
+		{}
+
+		unsigned events;
+		unsigned dropped; // because the queue was full
+		float average, worst; // milliseconds from play() to the speaker
+	};
+
+	Mixer();
+	~Mixer();
+	Mixer(const Mixer&) = delete;
+	void operator=(const Mixer&) = delete;
+
+	void play(Sound::Effect, float, float);
+	Stats stats() const;
+
+private:
+	struct Event
+	{
+		Sound::Effect effect;
+		float volume, pan;
+		std::chrono::steady_clock::time_point posted;
+	};
+
+	struct Voice
+	{
+		Voice() : samples(NULL), position(0), left(0.0f), right(0.0f) {}
+
+		const std::vector<std::int16_t> *samples; // NULL when it's free
+		unsigned position;
+		float left, right;
+	};
+
+	void load(Sound::Effect, const char*);
+	void open();
+	void close();
+	void pump();
+	void start(const Event&, float);
+	void mix(unsigned);
+
+	std::vector<std::int16_t> samples[Sound::EFFECT_COUNT]; // mono, MIXER_RATE
+
+	// single producer (play()), single consumer (the mixer thread)
+	std::array<Event, MIXER_QUEUE> queue;
+	std::atomic<unsigned> head, tail; // next to take, next to fill
+	std::atomic<unsigned> dropped;
+
+	// mixer thread only
+	std::array<Voice, MIXER_VOICES> voices;
+	std::vector<float> accumulator;
+	std::vector<std::int16_t> out; // interleaved stereo
+	QAudioOutput *output;
+	QIODevice *device;
+	QTimer *timer;
+	Stats counting; // for the current second
+	double latency_sum;
+	std::chrono::steady_clock::time_point second;
+
+	mutable std::mutex stats_mutex;
+	Stats last_second;
+
+	QThread thread;
+	QObject context; // lives on <thread>
+};
+
+#endif // MIXER_H
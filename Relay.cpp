@@ -0,0 +1,398 @@
+#include <stdexcept>
+
+#include "Relay.h"
+
+Relay::Relay(const RelayConfig &config)
+	: last_step(0)
+	, fresh(false)
+	, win(false)
+	, secret(0)
+	, nonce(mersenne()(0, 2'000'000'000))
+	, input_step(0)
+	, last_upstream_time(milliseconds())
+	, last_ack_time(0)
+	, cookie_key((std::uint64_t(std::random_device()()) << 32) | std::random_device()())
+	, stats_interval(std::max(config.stats, 0))
+	, encode_nanoseconds(0)
+	, baseline_misses(0)
+	, garbage(0)
+	, desyncs(0)
+	, running(true)
+	, upstream_address(config.upstream + ":" + std::to_string(config.upstream_port))
+	, upstream(config.upstream, config.upstream_port)
+	, udp(config.port)
+{
+	if(!upstream)
+		throw std::runtime_error("Could not resolve " + config.upstream);
+	if(!udp)
+		throw std::runtime_error("Could not bind to port " + std::to_string(config.port));
+
+	waiter.watch(upstream.descriptor());
+	waiter.watch(udp.descriptor());
+
+	background = std::thread(loop, this);
+}
+
+Relay::~Relay()
+{
+	running = false;
+	waiter.wake();
+	background.join();
+}
+
+// ask upstream to take us as a spectator, every so often until it does
+void Relay::join()
+{
+	const auto now = std::chrono::steady_clock::now();
+	if(now - last_join < std::chrono::milliseconds(RELAY_JOIN_RETRY))
+		return;
+
+	last_join = now;
+
+	lmp::JoinRequest request;
+	request.nonce = nonce;
+	request.spectate = 1;
+
+	lmp::netbuf buffer(&upstream_traffic);
+	buffer.push(request);
+	upstream.send(buffer.raw.data(), buffer.size);
+}
+
+// decode what upstream broadcast, the same way a client does
+void Relay::recv_upstream()
+{
+	static const Snapshot blank;
+
+	lmp::netbuf buffer(&upstream_traffic);
+
+	while(lmp::netbuf::get(buffer, upstream))
+	{
+		last_upstream_time = milliseconds();
+
+		lmp::JoinReply reply;
+		if(buffer.pop(reply))
+		{
+			if(reply.nonce != nonce || secret != 0)
+				continue;
+
+			if(!reply.accepted)
+			{
+				lprintf("%s isn't taking spectators", upstream_address.c_str());
+				continue;
+			}
+
+			secret = reply.secret;
+			lprintf("watching %s", upstream_address.c_str());
+			continue;
+		}
+
+		lmp::ServerInfo info;
+		if(!buffer.pop(info))
+		{
+			++garbage;
+			buffer.reset();
+			continue;
+		}
+
+		// a keyframe more than a second behind: upstream started over, see Asteroids::recv()
+		if(info.has_id && info.baseline == 0 && last_step > info.stepno + info.tick)
+		{
+			lprintf("%s went back from step %u to %u, starting over", upstream_address.c_str(), last_step, info.stepno);
+			start_over();
+		}
+
+		// stale or duplicate
+		if(last_step != 0 && info.stepno <= last_step)
+		{
+			buffer.reset();
+			continue;
+		}
+
+		const std::uint32_t base_step = info.stepno - info.baseline;
+		const Snapshot &base = info.baseline == 0 ? blank : snapshots[base_step % RELAY_RING];
+		if(info.baseline != 0 && base.stepno != base_step)
+		{
+			++baseline_misses;
+			buffer.reset();
+			continue;
+		}
+
+		lmp::Delta delta;
+		if(!buffer.pop(delta))
+		{
+			++garbage;
+			buffer.reset();
+			continue;
+		}
+
+		Snapshot next;
+		next.stepno = info.stepno;
+		next.score = info.has_score ? info.score : base.score;
+		next.paused = info.paused == 1;
+
+		std::vector<const Record*> updated;
+		std::vector<Entity::Reference> removed, culled;
+		lmp::bitreader reader(delta.payload, delta.length);
+		if(!decode_delta(base, reader, next, updated, removed, culled))
+		{
+			++garbage;
+			continue;
+		}
+
+		lmp::Checksum checksum;
+		if(buffer.pop(checksum) && checksum.value != next.checksum)
+		{
+			lprintf("snapshot %u decoded differently than %s encoded it", info.stepno, upstream_address.c_str());
+			++desyncs;
+		}
+
+		if(info.has_id)
+		{
+			World::resize(info.world_width, info.world_height);
+			World::pace(info.tick);
+		}
+
+		snapshots[next.stepno % RELAY_RING] = std::move(next);
+		last_step = info.stepno;
+		win = info.win;
+		fresh = true;
+	}
+}
+
+// spectators joining and acknowledging, on our side
+void Relay::recv()
+{
+	net::udp_id udpid;
+	lmp::netbuf buffer;
+
+	while(lmp::netbuf::get(buffer, udp, udpid))
+	{
+		lmp::JoinRequest request;
+		if(buffer.pop(request))
+		{
+			// spectators only, there's no match here to play in
+			lmp::JoinReply reply;
+			reply.nonce = request.nonce;
+			reply.accepted = request.spectate && broadcaster.spectators.size() < MAX_SPECTATORS;
+			reply.secret = reply.accepted ? join_cookie(cookie_key, udpid, time(NULL) / COOKIE_LIFETIME, true) : 0;
+
+			lmp::netbuf out;
+			out.push(reply);
+			udp.send(out.raw.data(), out.size, udpid);
+			continue;
+		}
+
+		lmp::ClientInfo info;
+		if(!buffer.pop(info))
+		{
+			buffer.reset();
+			continue;
+		}
+		buffer.reset();
+
+		Spectator *spectator = broadcaster.find(info.secret);
+		if(spectator == NULL && valid_cookie(cookie_key, info.secret, udpid, true))
+			spectator = broadcaster.join(info.secret, udpid);
+
+		// only from where it joined, that's where the broadcasts go
+		if(spectator != NULL && spectator->udpid == udpid)
+			broadcaster.heard(*spectator, info.stepno);
+	}
+}
+
+// tell upstream what we're up to, so it has a baseline for us. as often as there's something new, and now and then
+// when there isn't so it doesn't drop us
+void Relay::ack()
+{
+	const std::int64_t now = milliseconds();
+	if(!fresh && now - last_ack_time < RELAY_KEEPALIVE)
+		return;
+
+	last_ack_time = now;
+
+	lmp::ClientInfo info;
+	info.secret = secret;
+	info.paused = 0;
+	info.stepno = last_step;
+	info.input_step = ++input_step;
+	info.clock = now;
+	info.frame_count = 1;
+
+	lmp::netbuf buffer(&upstream_traffic);
+	buffer.push(info);
+	upstream.send(buffer.raw.data(), buffer.size);
+}
+
+// the newest step again, encoded once for our own spectators
+void Relay::broadcast()
+{
+	if(!fresh)
+		return;
+
+	fresh = false;
+
+	const auto start = std::chrono::steady_clock::now();
+	const lmp::netbuf *const buffer = broadcaster.compile(snapshots[last_step % RELAY_RING], win);
+	encode_nanoseconds += std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count();
+	if(buffer == NULL)
+		return;
+
+	for(const Spectator &spectator : broadcaster.spectators)
+		udp.send(buffer->raw.data(), buffer->size, spectator.udpid);
+}
+
+void Relay::report()
+{
+	static int last_report = time(NULL);
+	const int now = time(NULL);
+	if(stats_interval == 0 || now - last_report < stats_interval)
+		return;
+
+	last_report = now;
+
+	const Broadcaster::Stats &stats = broadcaster.stats;
+	lprintf("upstream %s: %u datagrams in (%.1f/sec), %.2f kilobytes/sec, %u baselines missing, %u garbage, %u desyncs", upstream_address.c_str(),
+		upstream_traffic.datagrams, (double)upstream_traffic.datagrams / stats_interval, upstream_traffic.total / 1000.0 / stats_interval,
+		baseline_misses, garbage, desyncs);
+	lprintf("spectators: %u watching, %u broadcasts (%u keyframes) of %.1f bytes each, %llu datagrams sent, %.3f ms encoding each",
+		(unsigned)broadcaster.spectators.size(), stats.broadcasts, stats.keyframes,
+		stats.broadcasts ? (double)stats.traffic.total / stats.broadcasts : 0.0, stats.datagrams,
+		stats.broadcasts ? encode_nanoseconds / 1000000.0 / stats.broadcasts : 0.0);
+
+	broadcaster.stats = Broadcaster::Stats();
+	upstream_traffic = lmp::Traffic();
+	encode_nanoseconds = 0;
+	baseline_misses = 0;
+	garbage = 0;
+	desyncs = 0;
+}
+
+// forget upstream's steps. the next ones may well be lower (a restarted server counts from the start again), so
+// nothing decoded or broadcast so far is a baseline for them, and our spectators get a keyframe
+void Relay::start_over()
+{
+	last_step = 0;
+	fresh = false;
+	snapshots.fill(Snapshot());
+	broadcaster.restart();
+}
+
+// nothing to keep time with here, it's all driven by what comes in
+void Relay::loop(Relay *r)
+{
+	Relay &relay = *r;
+
+	while(relay.running)
+	{
+		if(relay.secret == 0)
+			relay.join();
+
+		relay.recv_upstream();
+
+		relay.recv();
+
+		if(relay.secret != 0)
+		{
+			relay.ack();
+
+			relay.broadcast();
+		}
+
+		// start over if upstream went away
+		if(milliseconds() - relay.last_upstream_time > SERVER_TIMEOUT)
+		{
+			lprintf("%s timed out, joining again", relay.upstream_address.c_str());
+			relay.secret = 0;
+			relay.start_over();
+			relay.last_upstream_time = milliseconds();
+		}
+
+		relay.broadcaster.check_timeout();
+
+		relay.udp.flush(); // join replies and the broadcast
+
+		relay.report();
+
+		if(relay.secret == 0)
+			relay.waiter.wait(RELAY_JOIN_RETRY);
+		else
+			relay.waiter.wait(relay.upstream.impaired_network() || relay.udp.impaired_network() ? RELAY_POLL : RELAY_KEEPALIVE);
+	}
+}
+
+#ifdef FREE_RELAY
+
+#ifndef _WIN32
+#include <signal.h>
+#endif // _WIN32
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+static std::atomic<bool> working;
+
+int main(int argc, char **argv)
+{
+	RelayConfig config;
+	for(int i = 1; i < argc; ++i)
+	{
+		unsigned port = 0;
+
+		if(!strcmp(argv[i], "--upstream") && i + 1 < argc)
+			config.upstream = argv[++i];
+		else if(!strcmp(argv[i], "--upstream-port") && i + 1 < argc && sscanf(argv[i + 1], "%u", &port) == 1 && port > 0 && port < 65536)
+		{
+			config.upstream_port = port;
+			++i;
+		}
+		else if(!strcmp(argv[i], "--port") && i + 1 < argc && sscanf(argv[i + 1], "%u", &port) == 1 && port > 0 && port < 65536)
+		{
+			config.port = port;
+			++i;
+		}
+		else if(!strcmp(argv[i], "--stats") && i + 1 < argc && sscanf(argv[i + 1], "%d", &config.stats) == 1 && config.stats >= 0)
+			++i;
+		else
+		{
+			config.upstream.clear();
+			break;
+		}
+	}
+
+	if(config.upstream.empty())
+	{
+		std::cout << "usage: " << argv[0] << " --upstream ADDRESS [--upstream-port PORT] [--port PORT] [--stats SECONDS]" << std::endl;
+		return 1;
+	}
+
+	working = true;
+#ifdef _WIN32
+	BOOL (WINAPI *handler)(DWORD) = [](DWORD sig){ working = false; return TRUE; };
+	SetConsoleCtrlHandler(handler, true);
+#else
+	void (*handler)(int) = [](int sig){ if(sig != SIGPIPE) working = false; };
+	signal(SIGINT, handler);
+	signal(SIGTERM, handler);
+	signal(SIGPIPE, handler);
+#endif // _WIN32
+
+	try
+	{
+		Relay relay(config);
+		std::cout << "[relaying " << config.upstream << ":" << config.upstream_port << " on udp:" << config.port << "]" << std::endl;
+		while(working)
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+		lprintf("exiting");
+	}
+	catch(const std::exception &e)
+	{
+		lprintf("%s", e.what());
+		return 1;
+	}
+
+	return 0;
+}
+
+#endif // FREE_RELAY
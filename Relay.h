@@ -0,0 +1,82 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "network.h"
+#include "Lump.h"
+#include "Snapshot.h"
+#include "Broadcast.h"
+
+#define RELAY_PORT (SERVER_PORT + 1)
+#define RELAY_RING 64 // decoded upstream snapshots kept as baselines for the next ones, like the client's
+#define RELAY_JOIN_RETRY 250 // milliseconds between join requests upstream
+#define RELAY_KEEPALIVE 1000 // milliseconds at most between acknowledgements upstream, when the stream is quiet
+#define RELAY_POLL 10 // milliseconds between polls on an impaired network
+
+// startup settings, from the relay's command line
+struct RelayConfig
+{
+	RelayConfig()
+		: upstream_port(SERVER_PORT)
+		, port(RELAY_PORT)
+		, stats(30)
+	{}
+
+	std::string upstream; // server, or another relay
+	unsigned short upstream_port;
+	unsigned short port; // to take spectators on
+	int stats; // seconds between reports, 0 for none
+};
+
+// fans a match out to more spectators than one server could send to.
+// a relay watches the server (or another relay) as a single spectator, decodes the broadcast, and broadcasts it
+// again to spectators of its own, against its own baselines. what the match costs upstream stays the same
+// however many watch through relays, and relays can be chained
+class Relay
+{
+public:
+	Relay(const RelayConfig&);
+	~Relay();
+
+private:
+	void join();
+	void recv_upstream();
+	void recv();
+	void ack();
+	void broadcast();
+	void report();
+	void start_over();
+	static void loop(Relay*);
+
+	std::array<Snapshot, RELAY_RING> snapshots; // indexed by stepno % RELAY_RING
+	std::uint32_t last_step; // newest one decoded, 0 for none
+	bool fresh; // <last_step> hasn't gone out yet
+	bool win;
+
+	std::int32_t secret; // from upstream, 0 until it took us
+	const std::uint32_t nonce;
+	std::uint32_t input_step;
+	std::int64_t last_upstream_time; // heard from upstream, milliseconds()
+	std::int64_t last_ack_time; // sent upstream
+	std::chrono::steady_clock::time_point last_join;
+
+	Broadcaster broadcaster;
+	const std::uint64_t cookie_key;
+	const int stats_interval;
+	lmp::Traffic upstream_traffic; // since the last report
+	unsigned long long encode_nanoseconds; // since the last report
+	unsigned baseline_misses, garbage, desyncs; // upstream, since the last report
+	std::atomic<bool> running;
+
+	const std::string upstream_address;
+	net::udp upstream;
+	net::udp_server udp;
+	net::waiter waiter;
+	std::thread background;
+};
+
+#endif // RELAY_H
@@ -1,31 +1,81 @@
+#include <algorithm>
 #include <stdexcept>
 
 #include "Server.h"
 
 int Client::last_id = 0;
 
-Server::Server()
-	: max_score(500)
-	, gameover_timer(TIMER_GAMEOVER)
-	, win_timer(TIMER_WIN)
+Server::Server(const ServerConfig &config)
+	: history(std::max(config.history, 1u))
+	, lockstep(config.lockstep)
+	, match_start(0)
+	, ticks_first(1)
+	, checksum_step(0)
+	, checksum(0)
 	, random(time(NULL))
+	, seed(config.seed != 0 ? config.seed : (std::uint64_t(std::random_device()()) << 32) | std::random_device()())
+	, stats_interval(std::max(config.stats, 0))
+	, client_rate(std::max(config.rate, 0))
+	, snapshot_rate(std::max(config.snapshots > 0 ? config.snapshots : config.tick, config.lockstep ? (MAX_TICK / LOCKSTEP_TICKS) + 1 : 1)) // a lockstep datagram holds so many steps
+	, input_frames(0)
+	, input_clock(0)
+	, workers(config.threads)
+	, cookie_key((std::uint64_t(std::random_device()()) << 32) | std::random_device()())
 	, running(true)
 	, tcp(SERVER_PORT)
-	, udp(SERVER_PORT)
+	, udp(SERVER_PORT, config.shards > 1)
 	, last(std::chrono::high_resolution_clock::now())
-	, background(Server::loop, this)
 {
 	if(!tcp || !udp)
-	{
-		running = false;
-		background.join();
 		throw std::runtime_error("Could not bind to port " + std::to_string(SERVER_PORT));
+
+	waiter.watch(tcp.descriptor());
+	waiter.watch(udp.descriptor());
+
+	for(int i = 1; i < config.shards; ++i)
+	{
+		net::udp_server shard(SERVER_PORT, true, i);
+		if(!shard)
+		{
+			lprintf("could not share udp port %d any further", SERVER_PORT);
+			break;
+		}
+
+		waiter.watch(shard.descriptor());
+		shards.push_back(std::move(shard));
 	}
+	inboxes.resize(shards.size() + 1);
+
+	World::resize(config.world_width, config.world_height);
+	World::pace(config.tick);
+	if(snapshot_rate < World::tick || World::tick != BASE_TICK)
+		lprintf("simulating %d steps/sec, sending %d snapshots/sec", World::tick, std::min(snapshot_rate, World::tick));
+	if(World::sectors() > 1)
+		lprintf("world is %dx%d, %d sectors", World::width, World::height, World::sectors());
+	if(config.seed != 0 || workers.count() > 1)
+		lprintf("simulation seed %llu, %d threads", (unsigned long long)seed, workers.count());
+	if(client_rate > 0)
+		lprintf("sending at most %d bytes/sec to each client", client_rate);
+	if(lockstep)
+		lprintf("lockstep: relaying inputs, clients simulate");
+	if(shards.size() > 0)
+		lprintf("receiving on %u sockets", (unsigned)inboxes.size());
+
+	workers.timing([this](const char *name, int, std::chrono::nanoseconds took)
+	{
+		std::lock_guard<std::mutex> lock(timing_mutex);
+		TaskTime &t = timing[name];
+		t.nanoseconds += took.count();
+		++t.tasks;
+	});
+
+	background = std::thread(Server::loop, this);
 }
 
 Server::~Server()
 {
 	running = false;
+	waiter.wake();
 	background.join();
 }
 
@@ -42,7 +92,7 @@ void Server::wait()
 		// sorry windows, but your Sleep(...) sucks
 		std::this_thread::sleep_for(std::chrono::microseconds(100));
 #endif
-	}while(diff.count() < 16666000);
+	}while(diff.count() < 1000000000 / World::tick);
 
 	last = current;
 
@@ -52,7 +102,7 @@ void Server::wait()
 		const int current = time(NULL);
 		if(current != second)
 		{
-			if(state.stepno > 200 && sps < 56 && sps != 1)
+			if(state.stepno > 200 && sps < World::tick - (World::tick / 15) && sps != 1)
 				lprintf("sps == %d -- having trouble keeping up", sps);
 			sps = 0;
 			second = current;
@@ -85,6 +135,60 @@ void Server::accept()
 
 	client_list.push_back(client);
 	state.player_list.push_back(player);
+	if(lockstep)
+		restart();
+}
+
+// stateless udp join, syn cookie style.
+// the secret handed out is derived from the client's address, so nothing is allocated until the client
+// proves it can receive at that address by echoing the secret back in its first ClientInfo
+void Server::handshake(const lmp::JoinRequest &request, const net::udp_id &udpid)
+{
+	lmp::JoinReply reply;
+	reply.nonce = request.nonce;
+	if(request.spectate)
+		reply.accepted = !lockstep && broadcaster.spectators.size() < MAX_SPECTATORS; // lockstep relays inputs per client, there's nothing to broadcast
+	else
+		reply.accepted = client_list.size() < MAX_PLAYERS;
+	reply.secret = reply.accepted ? join_cookie(cookie_key, udpid, time(NULL) / COOKIE_LIFETIME, request.spectate) : 0;
+
+	lmp::netbuf buffer;
+	buffer.push(reply);
+	udp.send(buffer.raw.data(), buffer.size, udpid);
+}
+
+// turn a valid cookie into a client
+// returns NULL if the cookie is forged or expired, or if there is no room
+Client *Server::admit(std::int32_t secret, const net::udp_id &udpid)
+{
+	if(!valid_cookie(cookie_key, secret, udpid, false) || spent.count(secret))
+		return NULL;
+
+	if(client_list.size() >= MAX_PLAYERS)
+		return NULL;
+
+	if(client_list.size() == 0)
+		state.reset();
+
+	Client client(++Client::last_id, secret);
+	client.udpid = udpid;
+	Player player(client.id);
+
+	client_list.push_back(client);
+	state.player_list.push_back(player);
+	if(lockstep)
+		restart();
+
+	return &client_list.back();
+}
+
+// same for a spectator's cookie. there's no player to add
+Spectator *Server::admit_spectator(std::int32_t secret, const net::udp_id &udpid)
+{
+	if(lockstep || !valid_cookie(cookie_key, secret, udpid, true))
+		return NULL;
+
+	return broadcaster.join(secret, udpid);
 }
 
 void Server::kick(const Client &client, const std::string &reason)
@@ -103,173 +207,638 @@ void Server::kick(const Client &client, const std::string &reason)
 		if((*it).id == client.id)
 		{
 			lprintf("client %d kicked (%s)", client.id, reason.c_str());
+			bandwidth += it->bandwidth;
 			client_list.erase(it);
 			break;
 		}
 	}
+
+	if(lockstep)
+		restart();
 }
 
+// lockstep: everybody starts over from the same fresh state, the only way to line up a roster change
+// when the clients only ever see inputs
+void Server::restart()
+{
+	std::vector<std::int32_t> roster;
+	for(const Player &p : state.player_list)
+		roster.push_back(p.id);
+
+	state.restart(roster, state.stepno);
+	match = Match();
+	match_start = state.stepno;
+	ticks.clear();
+	ticks_first = match_start + 1;
+	checksum_step = 0;
+}
+
+// clients are encoded and sent to in parallel. compile_datagram() only writes to its own client
 void Server::send()
 {
-	for(const Client &client : client_list)
+	encoded.clear();
+
+	workers.parallel_for("send", client_list.size(), 1, [this](unsigned i)
 	{
+		Client &client = client_list[i];
 		if(!client.udpid.initialized)
-			continue;
+			return;
 
-		lmp::netbuf buffer;
-		compile_datagram(client, buffer);
+		// counted into <traffic> first, an empty datagram is thrown away
+		lmp::Traffic traffic;
+		lmp::netbuf buffer(&traffic);
+		if(lockstep)
+			compile_lockstep(client, buffer);
+		else
+			compile_datagram(client, buffer);
 		if(buffer.size == 0)
-			continue;
+		{
+			++client.bandwidth.suppressed;
+			return;
+		}
 
 		udp.send(buffer.raw.data(), buffer.size, client.udpid);
-	}
+		client.bytes_sent += buffer.size;
+		if(!client.greeted)
+		{
+			const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - client.connected;
+			lprintf("client %d: first snapshot %.3f ms after connecting", client.id, took.count());
+			client.greeted = true;
+		}
+		traffic.datagram(buffer.size);
+		client.bandwidth.traffic += traffic;
+	});
+
+	if(!lockstep)
+		broadcast();
+
+	udp.flush();
 }
 
-void Server::recv()
+// spectators all get the same datagram
+void Server::broadcast()
 {
-	net::udp_id udpid;
-	lmp::netbuf net_buffer;
+	const auto start = std::chrono::steady_clock::now();
+	const lmp::netbuf *const buffer = broadcaster.compile(snapshot, Match::won(state));
+	if(buffer == NULL)
+		return;
 
-	while(lmp::netbuf::get(net_buffer, udp, udpid))
 	{
-		// udpid related nonsense
-		const lmp::ClientInfo *const info = net_buffer.pop<lmp::ClientInfo>();
-		if(info == NULL)
-		{
-			lprintf("no client info present in net buffer");
-			continue;
-		}
-
-		Client *const client = Client::by_secret(info->secret, client_list);
-		if(client == NULL)
-		{
-			lprintf("received a datagram from an unrecognized client");
-			continue;
-		}
-		else if(!client->udpid.initialized)
-		{
-			client->udpid = udpid;
-		}
-
-		integrate_client(*client, *info);
+		const std::chrono::nanoseconds took = std::chrono::steady_clock::now() - start;
+		std::lock_guard<std::mutex> lock(timing_mutex);
+		TaskTime &t = timing["broadcast"];
+		t.nanoseconds += took.count();
+		++t.tasks;
 	}
+
+	workers.parallel_for("fan out", broadcaster.spectators.size(), 64, [this, buffer](unsigned i)
+	{
+		udp.send(buffer->raw.data(), buffer->size, broadcaster.spectators[i].udpid);
+	});
 }
 
-void Server::compile_datagram(const Client &client, lmp::netbuf &buffer)
+// every socket on the port is drained at once, by the workers. a spectator's ack only touches that spectator, so
+// it's taken care of right there. the rest may change who's connected, it's gone through afterwards, in order
+void Server::recv()
 {
-	const Player &current = client.player(state.player_list);
-	int repair_percentage = current.percent_repair;
-	// see if this guy is repairing anything
-	if(repair_percentage == 0)
+	workers.parallel_for("recv", inboxes.size(), 1, [this](unsigned i)
 	{
-		// see if this guy is being repaired
-		for(const Player &p : state.player_list)
+		net::udp_server &socket = i == 0 ? udp : shards[i - 1];
+		Inbox &inbox = inboxes[i];
+		lmp::netbuf net_buffer(&inbox.received);
+
+		Pending pending;
+		while(lmp::netbuf::get(net_buffer, socket, pending.udpid))
 		{
-			if(&current == &p)
+			// udp join handshake
+			pending.join = net_buffer.pop(pending.request);
+			if(pending.join)
+			{
+				inbox.pending.push_back(pending);
 				continue;
+			}
 
-			if(p.repairing_id == current.id)
+			// udpid related nonsense
+			if(!net_buffer.pop(pending.info))
 			{
-				repair_percentage = p.percent_repair;
-				break;
+				lprintf("no client info present in net buffer");
+				continue;
+			}
+
+			// a spectator's inputs go nowhere, only the step it's up to matters. the address it joined from keeps
+			// it on one socket. from anywhere else it waits for dispatch(), which drops it
+			Spectator *const spectator = broadcaster.find(pending.info.secret);
+			if(spectator != NULL && spectator->udpid == pending.udpid)
+			{
+				broadcaster.heard(*spectator, pending.info.stepno);
+				continue;
 			}
+
+			inbox.pending.push_back(pending);
 		}
+	});
+
+	for(Inbox &inbox : inboxes)
+	{
+		for(const Pending &pending : inbox.pending)
+			dispatch(pending);
+		inbox.pending.clear();
+
+		received += inbox.received;
+		inbox.received = lmp::Traffic();
 	}
 
-	bool info_present = false;
-	const GameState &oldstate = get_hist_state(client.stepno);
+	udp.flush(); // join replies
+}
+
+// joins, players, and spectators recv() couldn't take care of
+void Server::dispatch(const Pending &pending)
+{
+	const net::udp_id &udpid = pending.udpid;
+	const lmp::ClientInfo &info = pending.info;
+
+	if(pending.join)
+	{
+		handshake(pending.request, udpid);
+		return;
+	}
+
+	// broadcasts keep going to the address a spectator joined from, like a client's datagrams. an ack from
+	// anywhere else mustn't keep it alive
+	Spectator *spectator = broadcaster.find(info.secret);
+	if(spectator == NULL)
+		spectator = admit_spectator(info.secret, udpid);
+	if(spectator != NULL)
+	{
+		if(spectator->udpid == udpid)
+			broadcaster.heard(*spectator, info.stepno);
+		return;
+	}
+
+	Client *client = Client::by_secret(info.secret, client_list);
+	if(client == NULL)
+		client = admit(info.secret, udpid);
+
+	if(client == NULL)
+	{
+		lprintf("received a datagram from an unrecognized client");
+		return;
+	}
+	else if(!client->udpid.initialized)
+	{
+		client->udpid = udpid;
+	}
+
+	integrate_client(*client, info);
+}
+
+void Server::compile_datagram(Client &client, lmp::netbuf &buffer)
+{
+	static const Snapshot blank;
+
+	// delta against whatever the client last acknowledged
+	const Snapshot *const acked = client.baseline(client.stepno);
+	const unsigned age = acked ? state.stepno - acked->stepno : 0;
+	const bool has_baseline = acked != NULL && age > 0 && age < 256;
+	const Snapshot &base = has_baseline ? *acked : blank;
 
 	// server info
 	lmp::ServerInfo info;
 	info.stepno = state.stepno;
+	info.baseline = has_baseline ? age : 0;
+	info.has_id = !has_baseline;
 	info.my_id = client.id;
-	if(oldstate.score != state.score)
-		info_present = true;
-	info.repair = repair_percentage;
-	if(repair_percentage != 0)
-		info_present = true;
-	info.paused = state.paused;
-	if((info.paused == 1) != oldstate.paused)
-		info_present = true;
+	info.world_width = World::width;
+	info.world_height = World::height;
+	info.tick = World::tick;
+	info.repair = repair_percentage(client);
+	info.has_repair = info.repair != 0;
 	info.score = state.score;
-	info.win = check_win();
-	if(info.win)
-		info_present = true;
+	info.has_score = !has_baseline || base.score != state.score;
+	info.paused = state.paused;
+	info.win = Match::won(state);
+	stamp(client, info);
 	buffer.push(info);
+	const unsigned info_size = buffer.size;
+
+	// entity changes, most important first
+	Snapshot view;
+	cull(client, view);
+	std::vector<float> priority;
+	prioritize(client, view, priority);
+
+	lmp::Delta delta;
+	DeltaStats stats;
+	Snapshot sent;
+	sent.stepno = state.stepno;
+	sent.score = state.score;
+	sent.paused = state.paused;
+	// now and then what the client should end up with, so it can tell if it didn't
+	const bool checksum_due = state.stepno - client.checksummed >= SNAPSHOT_CHECKSUM;
+	lmp::Checksum checksum;
+
+	// as much as the datagram holds, or the rate cap allows
+	unsigned capacity = buffer.raw.size() - buffer.size - sizeof(lmp::Type) - sizeof(delta.length) - (checksum_due ? sizeof(lmp::Type) + sizeof(checksum.value) : 0);
+	if(client_rate > 0)
+	{
+		const int per_datagram = std::max(client_rate / std::min(snapshot_rate, World::tick), 1);
+		client.allowance = std::min(client.allowance + per_datagram, per_datagram * 4);
+		const int room = client.allowance - (int)(buffer.size + sizeof(lmp::Type) + sizeof(delta.length));
+		capacity = std::max(std::min(room, (int)capacity), 1);
+	}
 
-	std::vector<const Entity*> ent_list;
+	// clients that acknowledged the same thing and see the same thing get the same bytes, they're encoded once
+	std::array<std::uint8_t, MAX_DATAGRAM_SIZE> payload;
+	delta.payload = payload.data();
+	const EncodedDelta *const reuse = encoded_for(base, view, capacity);
+	if(reuse != NULL)
+	{
+		std::copy(reuse->payload.begin(), reuse->payload.end(), payload.begin());
+		delta.length = reuse->payload.size();
+		sent = reuse->sent;
+		stats = reuse->stats;
+		std::fill(priority.begin(), priority.end(), 0.0f);
+		++client.bandwidth.reused;
+	}
+	else
+	{
+		lmp::bitwriter writer(payload.data(), capacity);
+		encode_delta(base, view, snapshot, writer, sent, stats, &priority);
+		delta.length = writer.bytes();
+	}
+	buffer.push(delta);
 
-	// figure out what players have changed
-	compile_diff(oldstate.player_list, state.player_list, ent_list);
-	for(const auto subject : ent_list)
+	// whatever didn't make it waits for the next step, a little more important
+	client.priority.clear();
+	for(unsigned i = 0; i < view.records.size(); ++i)
 	{
-		info_present = true;
-		buffer.push(lmp::Player(*(Player*)subject));
+		if(priority[i] > 0.0f)
+			client.priority.push_back({view.records[i].kind, view.records[i].id, priority[i]});
 	}
 
-	// figure out what asteroids have changed
-	ent_list.clear();
-	compile_diff(oldstate.asteroid_list, state.asteroid_list, ent_list);
-	for(const auto subject : ent_list)
+	if(reuse == NULL && stats.deferred == 0 && client_list.size() > 1)
+		remember_encoded(base, std::move(view), sent, stats, delta);
+
+	const CompactSnapshot *const old = get_hist_state(client.stepno);
+	account_legacy(client, old, info.repair);
+
+	const bool info_present =
+		info.has_id ||
+		info.has_repair ||
+		info.has_score ||
+		(info.paused == 1) != base.paused ||
+		info.win ||
+		stats.changes() > 0;
+
+	if(!info_present)
 	{
-		info_present = true;
-		buffer.push(lmp::Asteroid(*(Asteroid*)subject));
+		buffer.reset();
+		return;
 	}
 
-	// figure out what ships have changed
-	ent_list.clear();
-	compile_diff(oldstate.ship_list, state.ship_list, ent_list);
-	for(const auto subject : ent_list)
+	const unsigned delta_size = buffer.size - info_size;
+	if(checksum_due)
 	{
-		info_present = true;
-		buffer.push(lmp::Ship(*(Ship*)subject));
+		checksum.value = sent.checksum;
+		buffer.push(checksum);
+		client.checksummed = state.stepno;
 	}
 
-	// figure out what entities have been deleted
-	std::vector<Entity::Reference> remove_list;
-	compile_remove_diff(Entity::Type::PLAYER, oldstate.player_list, state.player_list, remove_list);
-	compile_remove_diff(Entity::Type::ASTEROID, oldstate.asteroid_list, state.asteroid_list, remove_list);
-	compile_remove_diff(Entity::Type::SHIP, oldstate.ship_list, state.ship_list, remove_list);
-	for(const auto subject : remove_list)
+	// remember what the client will have, baselines older than the one just used won't be asked for again
+	while(client.sent.size() > 0 && (client.sent.front().stepno < client.stepno || client.sent.size() >= CLIENT_SNAPSHOTS))
+		client.sent.pop_front();
+	client.sent.push_back(std::move(sent));
+	client.allowance -= buffer.size;
+
+	Bandwidth &bandwidth = client.bandwidth;
+	++bandwidth.datagrams;
+	bandwidth.deferred += stats.deferred;
+	++(has_baseline ? bandwidth.baseline_hits : bandwidth.baseline_misses);
+	++(old != NULL ? bandwidth.history_hits : bandwidth.history_misses);
+	bandwidth.packed[(int)lmp::Type::SERVER_INFO] += info_size;
+	bandwidth.packed[(int)lmp::Type::DELTA] += delta_size - delta.length;
+	bandwidth.packed[(int)lmp::Type::CHECKSUM] += buffer.size - info_size - delta_size;
+	bandwidth.packed[(int)lmp::Type::PLAYER] += stats.bits[(int)Entity::Type::PLAYER] / 8;
+	bandwidth.packed[(int)lmp::Type::ASTEROID] += stats.bits[(int)Entity::Type::ASTEROID] / 8;
+	bandwidth.packed[(int)lmp::Type::SHIP] += stats.bits[(int)Entity::Type::SHIP] / 8;
+	bandwidth.packed[(int)lmp::Type::REMOVE] += stats.remove_bits / 8;
+}
+
+// lockstep: the match's seed and roster, and the inputs for every step the client hasn't acknowledged
+void Server::compile_lockstep(Client &client, lmp::netbuf &buffer)
+{
+	// the client acknowledging a step at or before the start hasn't started this match yet
+	const bool started = client.stepno > match_start;
+
+	lmp::ServerInfo info;
+	info.stepno = state.stepno;
+	info.has_id = !started;
+	info.my_id = client.id;
+	info.world_width = World::width;
+	info.world_height = World::height;
+	info.tick = World::tick;
+	info.paused = state.paused;
+	info.win = Match::won(state);
+	stamp(client, info);
+	buffer.push(info);
+	const unsigned info_size = buffer.size;
+
+	lmp::Lockstep lump;
+	lump.start = match_start;
+	lump.seed = seed;
+	lump.checksum_step = checksum_step;
+	lump.checksum = checksum;
+	lump.player_count = state.player_list.size();
+	for(unsigned i = 0; i < state.player_list.size(); ++i)
+		lump.roster[i] = state.player_list[i].id;
+
+	lump.first = started ? client.stepno + 1 : match_start + 1;
+	if(lump.first < ticks_first)
 	{
-		info_present = true;
-		buffer.push(lmp::Remove(subject));
+		// those are gone, nothing to do but drop the client
+		client.behind = true;
+		lump.first = ticks_first;
 	}
+	const std::uint32_t pending = state.stepno >= lump.first ? state.stepno - lump.first + 1 : 0;
+	lump.tick_count = std::min<std::uint32_t>(pending, LOCKSTEP_TICKS);
+	for(int i = 0; i < lump.tick_count; ++i)
+		lump.ticks[i] = ticks[lump.first - ticks_first + i];
+	buffer.push(lump);
+
+	Bandwidth &bandwidth = client.bandwidth;
+	++bandwidth.datagrams;
+	bandwidth.packed[(int)lmp::Type::SERVER_INFO] += info_size;
+	bandwidth.packed[(int)lmp::Type::LOCKSTEP] += buffer.size - info_size;
+}
 
-	if(!info_present)
-		buffer.reset();
+// area of interest.
+// asteroids come into view within VIEW_RADIUS of the client's player, and stay until they're past
+// VIEW_RADIUS + VIEW_HYSTERESIS so they don't flap in and out. players and ships are always relevant
+void Server::cull(Client &client, Snapshot &view) const
+{
+	const Player &me = client.player(state.player_list);
+	const float center_x = me.x + (PLAYER_WIDTH / 2);
+	const float center_y = me.y + (PLAYER_HEIGHT / 2);
+
+	std::vector<std::int32_t> interest;
+
+	view.stepno = snapshot.stepno;
+	view.score = snapshot.score;
+	view.paused = snapshot.paused;
+	view.records.clear();
+	view.records.reserve(snapshot.records.size());
+	view.checksum = 0;
+
+	for(const Record &record : snapshot.records)
+	{
+		if(record.kind != Entity::Type::ASTEROID)
+		{
+			view.add(record);
+			continue;
+		}
+
+		const float half = Asteroid::size((AsteroidType)record.field[Record::SUBTYPE]) / 2.0f;
+		const float dx = Record::position(record.field[Record::X]) + half - center_x;
+		const float dy = Record::position(record.field[Record::Y]) + half - center_y;
+
+		const bool in_view = std::binary_search(client.interest.begin(), client.interest.end(), record.id);
+		const float radius = in_view ? VIEW_RADIUS + VIEW_HYSTERESIS : VIEW_RADIUS;
+		if((dx * dx) + (dy * dy) > radius * radius)
+			continue;
+
+		view.add(record);
+		interest.push_back(record.id);
+	}
+
+	client.interest = std::move(interest);
 }
 
-void Server::integrate_client(Client &client, const lmp::ClientInfo &lump)
+// echo the client's clock back, so it can time the round trip and tell where our step counter is
+void Server::stamp(const Client &client, lmp::ServerInfo &info) const
 {
-	client.controls.x = lump.x;
-	client.controls.y = lump.y;
-	client.controls.fire = lump.fire == 1;
-	client.controls.angle = lump.angle;
-	client.stepno = lump.stepno;
-	client.last_datagram_time = time(NULL);
-	Player &player = client.player(state.player_list);
-	player.shooting = client.controls.fire;
-	player.rot = client.controls.angle;
-	client.paused = lump.paused == 1;
+	info.has_echo = client.echo_time != 0;
+	info.echo = client.echo;
+	info.hold = std::min<std::int64_t>(milliseconds() - client.echo_time, 65535);
+}
+
+// what another client got this step against <base> for <view>, NULL if nobody did or it needs more than <capacity> bytes
+const EncodedDelta *Server::encoded_for(const Snapshot &base, const Snapshot &view, unsigned capacity)
+{
+	std::lock_guard<std::mutex> lock(encoded_mutex);
+	for(const EncodedDelta &entry : encoded)
+	{
+		if(entry.stats.room <= capacity * 8 && entry.view == view && entry.base == base)
+			return &entry;
+	}
+
+	return NULL;
+}
+
+void Server::remember_encoded(const Snapshot &base, Snapshot &&view, const Snapshot &sent, const DeltaStats &stats, const lmp::Delta &delta)
+{
+	EncodedDelta entry;
+	entry.base = base;
+	entry.view = std::move(view);
+	entry.sent = sent;
+	entry.stats = stats;
+	entry.payload.assign(delta.payload, delta.payload + delta.length);
+
+	std::lock_guard<std::mutex> lock(encoded_mutex);
+	encoded.push_back(std::move(entry));
 }
 
-const GameState &Server::get_hist_state(unsigned stepno) const
+// each entity in <view> gains its weight for this step on top of what it built up waiting.
+// the encoder zeroes the ones the client is up to date on
+void Server::prioritize(const Client &client, const Snapshot &view, std::vector<float> &priority) const
 {
-	for(const GameState &st : history)
+	const Player &me = client.player(state.player_list);
+	const float center_x = me.x + (PLAYER_WIDTH / 2);
+	const float center_y = me.y + (PLAYER_HEIGHT / 2);
+
+	priority.resize(view.records.size());
+
+	auto waiting = client.priority.begin();
+	const auto waiting_end = client.priority.end();
+	for(unsigned i = 0; i < view.records.size(); ++i)
 	{
-		if(st.stepno == stepno)
+		const Record &record = view.records[i];
+
+		while(waiting != waiting_end && (waiting->kind < record.kind || (waiting->kind == record.kind && waiting->id < record.id)))
+			++waiting;
+		const bool waited = waiting != waiting_end && waiting->kind == record.kind && waiting->id == record.id;
+
+		float weight;
+		switch(record.kind)
 		{
-			return st;
+			case Entity::Type::PLAYER:
+				weight = record.id == client.id ? PRIORITY_SELF : PRIORITY_PLAYER;
+				break;
+			case Entity::Type::SHIP:
+				weight = PRIORITY_SHIP;
+				break;
+			default:
+			{
+				const float half = Asteroid::size((AsteroidType)record.field[Record::SUBTYPE]) / 2.0f;
+				const float dx = Record::position(record.field[Record::X]) + half - center_x;
+				const float dy = Record::position(record.field[Record::Y]) + half - center_y;
+				weight = PRIORITY_ASTEROID * PRIORITY_FALLOFF / (PRIORITY_FALLOFF + sqrtf((dx * dx) + (dy * dy)));
+				break;
+			}
 		}
+
+		priority[i] = (waited ? waiting->accumulated : 0.0f) + weight;
+	}
+}
+
+// what the old format's diff() looked at
+static bool legacy_changed(const Record &old, const Record &now)
+{
+	static const int fields[][5] =
+	{
+		{ Record::FLAGS, Record::HEALTH, Record::X, Record::Y, Record::ROT }, // players
+		{ Record::XV, Record::YV, -1 }, // asteroids
+		{ Record::HEALTH, Record::XV, -1 } // ships
+	};
+
+	for(const int field : fields[(int)now.kind])
+	{
+		if(field == -1)
+			break;
+		if(old.field[field] != now.field[field])
+			return true;
+	}
+
+	return false;
+}
+
+// size up what the old format would have sent, for the bandwidth report. <old> is NULL if the client's last
+// acknowledged step is out of the history window, the old format sent everything then
+void Server::account_legacy(Client &client, const CompactSnapshot *old, int repair)
+{
+	// the old lumps were all fixed size
+	static const unsigned lump_size[] =
+	{
+		[]{ lmp::netbuf b; lmp::Player(Player(0)).serialize(b); return b.size; }(),
+		[]{ lmp::netbuf b; mersenne m(0); lmp::Asteroid(Asteroid(AsteroidType::BIG, m, NULL, 0)).serialize(b); return b.size; }(),
+		[]{ lmp::netbuf b; mersenne m(0); lmp::Ship(Ship(m, 0)).serialize(b); return b.size; }()
+	};
+	static const unsigned remove_size = []{ lmp::netbuf b; lmp::Remove({Entity::Type::PLAYER, 0}).serialize(b); return b.size; }();
+	static const lmp::Type lump_type[] = { lmp::Type::PLAYER, lmp::Type::ASTEROID, lmp::Type::SHIP };
+
+	static const CompactSnapshot blank;
+	const CompactSnapshot &base = old ? *old : blank;
+
+	const unsigned info_size = 11; // the old ServerInfo was always the same size
+	bool info_present = repair != 0 || base.score != state.score || state.paused != base.paused || Match::won(state);
+
+	unsigned long long bytes[Bandwidth::TYPES] = {};
+	bytes[(int)lmp::Type::SERVER_INFO] = info_size;
+
+	// both sides are sorted, walk them together
+	auto old_it = base.records.begin();
+	const auto old_end = base.records.end();
+	for(const Record &record : snapshot.records)
+	{
+		for(; old_it != old_end && old_it->expand() < record; ++old_it)
+			bytes[(int)lmp::Type::REMOVE] += remove_size;
+
+		if(old_it != old_end && old_it->kind == (std::uint8_t)record.kind && old_it->id == record.id)
+		{
+			if(legacy_changed(old_it->expand(), record))
+				bytes[(int)lump_type[(int)record.kind]] += lump_size[(int)record.kind];
+			++old_it;
+		}
+		else
+			bytes[(int)lump_type[(int)record.kind]] += lump_size[(int)record.kind];
 	}
+	for(; old_it != old_end; ++old_it)
+		bytes[(int)lmp::Type::REMOVE] += remove_size;
 
-	return GameState::blank;
+	for(int i = 0; i < Bandwidth::TYPES; ++i)
+		if(i != (int)lmp::Type::SERVER_INFO && bytes[i] > 0)
+			info_present = true;
+
+	if(!info_present)
+		return;
+
+	Bandwidth &bandwidth = client.bandwidth;
+	++bandwidth.legacy_datagrams;
+	for(int i = 0; i < Bandwidth::TYPES; ++i)
+		bandwidth.legacy[i] += bytes[i];
+}
+
+int Server::repair_percentage(const Client &client) const
+{
+	const Player &current = client.player(state.player_list);
+	if(current.percent_repair != 0)
+		return current.percent_repair;
+
+	for(const Player &p : state.player_list)
+	{
+		if(&current == &p)
+			continue;
+
+		if(p.repairing_id == current.id)
+			return p.percent_repair;
+	}
+
+	return 0;
+}
+
+void Server::integrate_client(Client &client, const lmp::ClientInfo &lump)
+{
+	client.last_datagram_time = milliseconds();
+
+	// the queue sorts out duplicates and reordering, frames are played in Server::step.
+	// the client's steps count from 1, a frame from before that would wrap around to a step 2^32 ahead and leave
+	// every real one after it late
+	for(int i = 0; i < lump.frame_count && (std::uint32_t)i < lump.input_step; ++i)
+	{
+		const lmp::ClientInfo::Frame &frame = lump.frames[i];
+
+		Controls controls;
+		controls.x = frame.x;
+		controls.y = frame.y;
+		controls.fire = frame.fire == 1;
+		controls.angle = frame.angle;
+
+		client.inputs.push(lump.input_step - i, controls);
+	}
+
+	// old news (reordered datagram)
+	if(lump.input_step <= client.input_step)
+		return;
+
+	client.inputs.arrival(lump.input_step, input_frames);
+	client.input_step = lump.input_step;
+	client.echo = lump.clock;
+	client.echo_time = client.last_datagram_time;
+	client.stepno = lump.stepno;
+	client.paused = lump.paused == 1;
+}
+
+// NULL if it's fallen out of the window
+const CompactSnapshot *Server::get_hist_state(std::uint32_t stepno) const
+{
+	const CompactSnapshot &slot = history[stepno % history.size()];
+
+	return stepno != 0 && slot.stepno == stepno ? &slot : NULL;
 }
 
 void Server::check_timeout()
 {
-	const int now = time(NULL);
+	const std::int64_t now = milliseconds();
+
+	broadcaster.check_timeout();
+
+	// a cookie is good for two epochs at most
+	for(auto it = spent.begin(); it != spent.end();)
+	{
+		if(time(NULL) - it->second >= 2 * COOKIE_LIFETIME)
+			it = spent.erase(it);
+		else
+			++it;
+	}
 
 	for(const Client &client : client_list)
 	{
@@ -281,9 +850,149 @@ void Server::check_timeout()
 			kick(client, "ping timeout");
 			return;
 		}
+
+		if(client.behind)
+		{
+			spent[client.secret] = time(NULL);
+			kick(client, "fell too far behind the lockstep");
+			return;
+		}
 	}
 }
 
+void Server::report()
+{
+	static int last_report = time(NULL);
+	const int now = time(NULL);
+	if(stats_interval == 0 || now - last_report < stats_interval)
+		return;
+
+	last_report = now;
+
+	unsigned asleep = 0, awake = 0;
+	for(const std::vector<Asteroid> &sector : state.dormant)
+		asleep += sector.size();
+	for(const bool active : state.active)
+		awake += active;
+	lprintf("%u of %d sectors awake, %u asteroids simulated, %u asleep", awake, World::sectors(), (unsigned)state.asteroid_list.size(), asleep);
+
+	// next to what a GameState copy per step (the old history) would hold for the same window
+	std::size_t history_bytes = 0;
+	for(const CompactSnapshot &slot : history)
+		history_bytes += slot.bytes();
+	const std::size_t copy_bytes = sizeof(GameState) + (state.player_list.size() * sizeof(Player)) +
+		((state.asteroid_list.size() + asleep) * sizeof(Asteroid)) + (state.ship_list.size() * sizeof(Ship));
+	lprintf("history: %u steps in %.1f KB (as GameState copies: %.1f KB)", (unsigned)history.size(), history_bytes / 1000.0,
+		(copy_bytes * history.size()) / 1000.0);
+
+	for(const Client &client : client_list)
+	{
+		const InputQueue::Stats &stats = client.inputs.stats();
+		lprintf("client %d input queue: depth %u, target %u, jitter %.2f, underruns %u, overruns %u, late %u",
+			client.id, stats.depth, stats.target, stats.jitter, stats.underruns, stats.overruns, stats.late);
+		lprintf("client %d: %.2f kilobytes/sec, %u of %u asteroids in view", client.id, client.bytes_sent / 1000.0 / stats_interval,
+			(unsigned)client.interest.size(), (unsigned)state.asteroid_list.size() + asleep);
+	}
+	for(Client &client : client_list)
+	{
+		bandwidth += client.bandwidth;
+		client.bandwidth = Bandwidth();
+		client.bytes_sent = 0;
+	}
+
+	// packed vs old format, per lump type
+	const struct { lmp::Type type; const char *name; } names[] =
+	{
+		{ lmp::Type::SERVER_INFO, "server info" },
+		{ lmp::Type::DELTA, "delta framing" },
+		{ lmp::Type::PLAYER, "players" },
+		{ lmp::Type::ASTEROID, "asteroids" },
+		{ lmp::Type::SHIP, "ships" },
+		{ lmp::Type::REMOVE, "removes" },
+		{ lmp::Type::LOCKSTEP, "lockstep" },
+		{ lmp::Type::CHECKSUM, "checksums" }
+	};
+
+	unsigned long long packed_total = 0, legacy_total = 0;
+	for(const auto &entry : names)
+	{
+		const unsigned long long packed = bandwidth.packed[(int)entry.type];
+		const unsigned long long legacy = bandwidth.legacy[(int)entry.type];
+		packed_total += packed;
+		legacy_total += legacy;
+
+		lprintf("bandwidth %-13s %8llu bytes (old format %8llu bytes)", entry.name, packed, legacy);
+	}
+	lprintf("bandwidth %-13s %8llu bytes in %u datagrams (old format %llu bytes in %u datagrams, %.1f%%)", "total",
+		packed_total, bandwidth.datagrams, legacy_total, bandwidth.legacy_datagrams, legacy_total ? (packed_total * 100.0) / legacy_total : 0.0);
+	if(bandwidth.deferred > 0)
+		lprintf("bandwidth: %u entity changes deferred for lack of room", bandwidth.deferred);
+	if(bandwidth.reused > 0)
+		lprintf("bandwidth: %u of %u datagrams reused entity changes encoded for another client", bandwidth.reused, bandwidth.datagrams);
+
+	// what went over the wire, by lump
+	const struct { const lmp::Traffic &traffic; const char *direction; } directions[] =
+	{
+		{ bandwidth.traffic, "out" },
+		{ received, "in" }
+	};
+	for(const auto &entry : directions)
+	{
+		lprintf("traffic %-3s %8u datagrams (%.1f/sec), %llu bytes", entry.direction, entry.traffic.datagrams,
+			(double)entry.traffic.datagrams / stats_interval, entry.traffic.total);
+		for(int i = 0; i < lmp::Traffic::TYPES; ++i)
+		{
+			if(entry.traffic.lumps[i] > 0)
+				lprintf("traffic %-3s %-13s %8u lumps, %llu bytes", entry.direction, lmp::name((lmp::Type)i), entry.traffic.lumps[i], entry.traffic.bytes[i]);
+		}
+	}
+	const unsigned baselines = bandwidth.baseline_hits + bandwidth.baseline_misses;
+	lprintf("baselines: %u hit, %u missed (%.1f%%), history: %u hit, %u missed, %u empty datagrams suppressed",
+		bandwidth.baseline_hits, bandwidth.baseline_misses, baselines ? (bandwidth.baseline_hits * 100.0) / baselines : 0.0,
+		bandwidth.history_hits, bandwidth.history_misses, bandwidth.suppressed);
+
+	const Broadcaster::Stats &broadcasts = broadcaster.stats;
+	if(broadcasts.broadcasts > 0 || broadcaster.spectators.size() > 0)
+	{
+		lprintf("spectators: %u watching, %u broadcasts (%u keyframes) of %.1f bytes each, %llu datagrams sent, %.2f kilobytes/sec to each",
+			(unsigned)broadcaster.spectators.size(), broadcasts.broadcasts, broadcasts.keyframes,
+			broadcasts.broadcasts ? (double)broadcasts.traffic.total / broadcasts.broadcasts : 0.0, broadcasts.datagrams,
+			broadcasts.traffic.total / 1000.0 / stats_interval);
+	}
+	broadcaster.stats = Broadcaster::Stats();
+
+	// what the sockets cost, failed polls included. an impaired network makes calls of its own that aren't counted
+	static unsigned long long last_syscalls = 0;
+	static std::uint32_t last_stepno = 0;
+	unsigned long long syscalls = udp.syscalls();
+	for(const net::udp_server &shard : shards)
+		syscalls += shard.syscalls();
+	const std::uint32_t steps = state.stepno - last_stepno;
+	if(!udp.impaired_network())
+		lprintf("sockets: %llu system calls through %s, %.1f per step", syscalls - last_syscalls, udp.backend(),
+			steps ? (double)(syscalls - last_syscalls) / steps : 0.0);
+	last_syscalls = syscalls;
+	last_stepno = state.stepno;
+
+	static unsigned long long last_failed = 0;
+	const unsigned long long failed = udp.failed_sends();
+	if(failed > last_failed)
+		lprintf("sockets: %llu datagrams couldn't be sent", failed - last_failed);
+	last_failed = failed;
+
+	bandwidth = Bandwidth();
+	received = lmp::Traffic();
+
+	// where the worker time went
+	std::lock_guard<std::mutex> lock(timing_mutex);
+	for(const auto &entry : timing)
+	{
+		lprintf("task %-10s %8u tasks, %7.3f ms per second, %.3f ms each (%d workers)", entry.first.c_str(), entry.second.tasks,
+			entry.second.nanoseconds / 1000000.0 / stats_interval, entry.second.nanoseconds / 1000000.0 / entry.second.tasks, workers.count());
+	}
+	timing.clear();
+}
+
 bool Server::check_pause() const
 {
 	for(const Client &c : client_list)
@@ -295,74 +1004,79 @@ bool Server::check_pause() const
 	return false;
 }
 
-bool Server::check_win() const
+// whether this step goes out to the clients, spread evenly at <snapshot_rate> a second
+bool Server::snapshot_due() const
 {
-	for(const Player &p : state.player_list)
-	{
-		if(p.health < 1)
-			return false;
-	}
+	const std::uint64_t step = state.stepno;
 
-	return state.score >= max_score && state.ship_list.size() == 0;
+	return snapshot_rate >= World::tick || (step * snapshot_rate) / World::tick != ((step - 1) * snapshot_rate) / World::tick;
 }
 
 void Server::step()
 {
-	++state.stepno;
-
-	if(!(state.paused = check_pause()))
+	// one input per player per BASE_TICK step, paused or not, so the queues stay in step.
+	// a faster tick holds each for more than one step, a slower one plays several and keeps the last,
+	// without losing a trigger tap from the ones before it
+	bool popped = false;
+	for(input_clock += BASE_TICK; input_clock >= World::tick; input_clock -= World::tick)
 	{
-		// see if players are all dead
-		bool gameover = true;
-		for(const Player &p : state.player_list)
+		for(Client &client : client_list)
 		{
-			if(p.health > 0)
-			{
-				gameover = false;
-				break;
-			}
+			const bool fire = popped && client.controls.fire;
+			client.controls = client.inputs.pop();
+			client.controls.fire = client.controls.fire || fire;
 		}
-		if(gameover)
+		popped = true;
+		++input_frames;
+	}
+
+	// the players' inputs, lined up with the player list
+	std::vector<Controls> controls(state.player_list.size());
+	for(const Client &client : client_list)
+		controls[&client.player(state.player_list) - state.player_list.data()] = client.controls;
+
+	const bool paused = check_pause();
+	if(lockstep)
+	{
+		// play the inputs exactly as the clients will get them, and keep them for the clients
+		lmp::Lockstep::Tick tick;
+		tick.bits = paused;
+		for(unsigned i = 0; i < controls.size(); ++i)
 		{
-			if(--gameover_timer == 0)
-			{
-				state.reset();
-				gameover_timer = TIMER_GAMEOVER;
-			}
+			tick.inputs[i] = lmp::Lockstep::quantize(controls[i]);
+			tick.bits |= controls[i].fire << (i + 1);
 		}
+		for(unsigned i = 0; i < controls.size(); ++i)
+			controls[i] = lmp::Lockstep::controls(tick, i);
 
-		const bool won = check_win();
-		if(won)
+		ticks.push_back(tick);
+		if(ticks.size() > LOCKSTEP_WINDOW)
 		{
-			if(--win_timer == 0)
-			{
-				state.reset();
-				win_timer = TIMER_WIN;
-			}
+			ticks.pop_front();
+			++ticks_first;
 		}
+	}
 
-		// process players
-		for(Client &client : client_list)
-			client.player(state.player_list).step(true, client.controls, state, 1.0f, random);
-
-		// process boooletts
-		Bullet::step(true, state, NULL, random);
+	match.step(state, controls, paused, seed, workers);
 
-		// process asteroids
-		Asteroid::step(true, state, NULL, random, 244);
-		if(won)
-			state.asteroid_list.clear();
+	if(lockstep)
+	{
+		if(state.stepno % LOCKSTEP_CHECKSUM == 0)
+		{
+			checksum_step = state.stepno;
+			checksum = state.checksum();
+		}
 
-		// process ships
-		Ship::step(true, state, NULL, 1.0f, random);
-		if(won)
-			state.ship_list.clear();
+		return;
 	}
 
-	// add this state to the history
-	history.push_back(state);
-	if(history.size() > STATE_HISTORY)
-		history.pop_front();
+	// only steps that go out are ever a baseline
+	if(!snapshot_due())
+		return;
+
+	// quantize this step, and keep it in the history ring for the bandwidth report
+	snapshot = Snapshot(state);
+	history[state.stepno % history.size()].pack(snapshot);
 }
 
 void Server::loop(Server *s)
@@ -373,20 +1087,23 @@ void Server::loop(Server *s)
 	{
 		server.accept(); // accept or reject new clients
 
-		if(server.client_list.size() > 0)
-		{
-			server.recv(); // receive data from clients
+		server.recv(); // receive data from clients (and udp join requests)
 
+		if(server.client_list.size() > 0 || server.broadcaster.spectators.size() > 0)
+		{
 			server.step(); // one world-simulation step
 
-			server.send(); // send data to clients
+			if(server.snapshot_due())
+				server.send(); // send data to clients
 
 			server.check_timeout(); // see who has timed out
 
+			server.report(); // periodic stats
+
 			server.wait(); // sleep (or spinlock) until time for next loop
 		}
 		else
-			std::this_thread::sleep_for(std::chrono::seconds(1));
+			server.waiter.wait(server.udp.impaired_network() ? SERVER_IDLE_POLL : -1); // until somebody knocks
 	}
 }
 
@@ -397,11 +1114,48 @@ void Server::loop(Server *s)
 #endif // _WIN32
 
 #include <iostream>
+#include <cstdio>
+#include <cstring>
 
 static std::atomic<bool> working;
 
-int main()
+int main(int argc, char **argv)
 {
+	ServerConfig config;
+	for(int i = 1; i < argc; ++i)
+	{
+		unsigned long long seed = 0;
+
+		if(!strcmp(argv[i], "--world") && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &config.world_width, &config.world_height) == 2)
+			++i;
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc && sscanf(argv[i + 1], "%d", &config.threads) == 1 && config.threads > 0)
+			++i;
+		else if(!strcmp(argv[i], "--history") && i + 1 < argc && sscanf(argv[i + 1], "%u", &config.history) == 1 && config.history > 0)
+			++i;
+		else if(!strcmp(argv[i], "--rate") && i + 1 < argc && sscanf(argv[i + 1], "%d", &config.rate) == 1 && config.rate >= 0)
+			++i;
+		else if(!strcmp(argv[i], "--lockstep"))
+			config.lockstep = true;
+		else if(!strcmp(argv[i], "--tick") && i + 1 < argc && sscanf(argv[i + 1], "%d", &config.tick) == 1 && config.tick >= MIN_TICK && config.tick <= MAX_TICK)
+			++i;
+		else if(!strcmp(argv[i], "--snapshots") && i + 1 < argc && sscanf(argv[i + 1], "%d", &config.snapshots) == 1 && config.snapshots > 0)
+			++i;
+		else if(!strcmp(argv[i], "--stats") && i + 1 < argc && sscanf(argv[i + 1], "%d", &config.stats) == 1 && config.stats >= 0)
+			++i;
+		else if(!strcmp(argv[i], "--shards") && i + 1 < argc && sscanf(argv[i + 1], "%d", &config.shards) == 1 && config.shards > 0 && config.shards <= 64)
+			++i;
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc && sscanf(argv[i + 1], "%llu", &seed) == 1)
+		{
+			config.seed = seed;
+			++i;
+		}
+		else
+		{
+			std::cout << "usage: " << argv[0] << " [--world WIDTHxHEIGHT] [--threads N] [--history REPORT_STEPS] [--seed N] [--stats SECONDS] [--rate BYTES] [--lockstep] [--tick HZ] [--snapshots HZ] [--shards N]" << std::endl;
+			return 1;
+		}
+	}
+
 	working = true;
 #ifdef _WIN32
 	BOOL (WINAPI *handler)(DWORD) = [](DWORD sig){ working = false; return TRUE; };
@@ -415,7 +1169,7 @@ int main()
 
 	try
 	{
-		Server server;
+		Server server(config);
 		std::cout << "[ready on tcp:" << SERVER_PORT << " udp:" << SERVER_PORT << "]" << std::endl;
 		while(working)
 			std::this_thread::sleep_for(std::chrono::milliseconds(500));
@@ -4,63 +4,255 @@
 #include <thread>
 #include <atomic>
 #include <chrono>
-#include <list>
+#include <deque>
+#include <map>
+#include <mutex>
 
 #include "network.h"
 #include "Lump.h"
+#include "Broadcast.h"
 #include "GameState.h"
+#include "Snapshot.h"
+#include "InputQueue.h"
+#include "Simulation.h"
 
 struct Client;
 
-#define TIMER_GAMEOVER 400
-#define TIMER_WIN 700
+#define STATE_HISTORY 256 // default steps of history, for the bandwidth report
+#define LOCKSTEP_WINDOW 256 // steps of inputs kept for lockstep clients to catch up from
+#define STATS_INTERVAL 30 // default seconds between stats reports
+
+// startup settings. the dedicated server takes them from its command line
+struct ServerConfig
+{
+	ServerConfig()
+		: world_width(DEFAULT_WORLD_WIDTH)
+		, world_height(DEFAULT_WORLD_HEIGHT)
+		, threads(1)
+		, history(STATE_HISTORY)
+		, seed(0)
+		, stats(STATS_INTERVAL)
+		, rate(0)
+		, lockstep(false)
+		, tick(BASE_TICK)
+		, snapshots(0)
+		, shards(1)
+	{}
+
+	int world_width, world_height;
+	int threads; // for the simulation
+	unsigned history; // steps of history kept for the bandwidth report. delta baselines come from Client::sent, not from here
+	std::uint64_t seed; // for the simulation. 0 picks one
+	int stats; // seconds between reports, 0 for none
+	int rate; // bytes per second to each client, 0 for as much as a datagram holds every step
+	bool lockstep; // relay inputs and let the clients simulate, instead of sending state
+	int tick; // simulation steps per second
+	int snapshots; // datagrams per second to each client, 0 for one every step
+	int shards; // udp sockets sharing the port, drained in parallel by the workers
+};
+
+// bytes that went out per lump type, next to what the old one-lump-per-entity format would have taken
+struct Bandwidth
+{
+	static constexpr int TYPES = lmp::Traffic::TYPES;
+
+	Bandwidth()
+		: packed{}
+		, legacy{}
+		, datagrams(0)
+		, legacy_datagrams(0)
+		, deferred(0)
+		, suppressed(0)
+		, baseline_hits(0)
+		, baseline_misses(0)
+		, history_hits(0)
+		, history_misses(0)
+		, reused(0)
+	{}
+
+	void operator+=(const Bandwidth &rhs)
+	{
+		for(int i = 0; i < TYPES; ++i)
+		{
+			packed[i] += rhs.packed[i];
+			legacy[i] += rhs.legacy[i];
+		}
+
+		datagrams += rhs.datagrams;
+		legacy_datagrams += rhs.legacy_datagrams;
+		deferred += rhs.deferred;
+		suppressed += rhs.suppressed;
+		baseline_hits += rhs.baseline_hits;
+		baseline_misses += rhs.baseline_misses;
+		history_hits += rhs.history_hits;
+		history_misses += rhs.history_misses;
+		reused += rhs.reused;
+		traffic += rhs.traffic;
+	}
+
+	unsigned long long packed[TYPES]; // indexed by lmp::Type
+	unsigned long long legacy[TYPES];
+	unsigned datagrams;
+	unsigned legacy_datagrams;
+	unsigned deferred; // entity changes that didn't fit in a datagram
+	unsigned suppressed; // datagrams not sent because there was nothing in them
+	unsigned baseline_hits, baseline_misses; // whether the client's acked snapshot could be a delta baseline
+	unsigned history_hits, history_misses; // whether get_hist_state() still had the client's acked step
+	unsigned reused; // datagrams whose entity changes were encoded for another client already
+	lmp::Traffic traffic; // what actually went out, by lump
+};
+
+// one client's entity changes for this step, for the others with the same baseline and the same view.
+// only ones that had everything fit are kept, so the priorities they went out with don't matter
+struct EncodedDelta
+{
+	Snapshot base;
+	Snapshot view;
+	Snapshot sent; // what the client will have decoded
+	DeltaStats stats;
+	std::vector<std::uint8_t> payload;
+};
+
+// a datagram Server::recv() leaves for the service thread, already popped
+struct Pending
+{
+	net::udp_id udpid;
+	bool join; // <request> if so, <info> if not
+	lmp::JoinRequest request;
+	lmp::ClientInfo info;
+};
+
+// what came in on one of the sockets sharing the port. each is drained by one worker
+struct Inbox
+{
+	std::vector<Pending> pending;
+	lmp::Traffic received; // since recv() last added it up
+};
+
+// time spent in worker tasks of one name
+struct TaskTime
+{
+	TaskTime() : nanoseconds(0), tasks(0) {}
+
+	unsigned long long nanoseconds;
+	unsigned tasks;
+};
+
+#define SERVER_IDLE_POLL 10 // milliseconds between polls when nobody is connected, on an impaired network
+#define CLIENT_SNAPSHOTS 64 // sent snapshots kept per client as possible delta baselines
+#define VIEW_RADIUS 1200 // asteroids come into a client's view this close to its player...
+#define VIEW_HYSTERESIS 200 // ...and leave it this much further out
+#define PRIORITY_SELF 64.0f // per step the client's own player waits to go out
+#define PRIORITY_PLAYER 8.0f // other players
+#define PRIORITY_SHIP 4.0f
+#define PRIORITY_ASTEROID 2.0f // asteroids, right next to the client's player...
+#define PRIORITY_FALLOFF 300.0f // ...and half that this far away
 
 class Server
 {
 public:
-	Server();
+	Server(const ServerConfig& = ServerConfig());
 	~Server();
 
 private:
 	void wait();
 	void accept();
+	void handshake(const lmp::JoinRequest&, const net::udp_id&);
+	Client *admit(std::int32_t, const net::udp_id&);
+	Spectator *admit_spectator(std::int32_t, const net::udp_id&);
 	void kick(const Client&, const std::string&);
 	void send();
+	void broadcast();
 	void recv();
-	void compile_datagram(const Client&, lmp::netbuf&);
+	void dispatch(const Pending&);
+	void compile_datagram(Client&, lmp::netbuf&);
+	void compile_lockstep(Client&, lmp::netbuf&);
+	void restart();
+	void cull(Client&, Snapshot&) const;
+	void prioritize(const Client&, const Snapshot&, std::vector<float>&) const;
+	void stamp(const Client&, lmp::ServerInfo&) const;
+	const EncodedDelta *encoded_for(const Snapshot&, const Snapshot&, unsigned);
+	void remember_encoded(const Snapshot&, Snapshot&&, const Snapshot&, const DeltaStats&, const lmp::Delta&);
+	void account_legacy(Client&, const CompactSnapshot*, int);
+	int repair_percentage(const Client&) const;
 	void integrate_client(Client&, const lmp::ClientInfo&);
-	const GameState &get_hist_state(unsigned) const;
+	const CompactSnapshot *get_hist_state(std::uint32_t) const;
 	void check_timeout();
+	void report();
 	bool check_pause() const;
-	bool check_win() const;
+	bool snapshot_due() const;
 	void step();
 	static void loop(Server*);
 
-	const int max_score;
-
 	GameState state;
-	std::list<GameState> history;
+	Match match;
+	std::vector<CompactSnapshot> history; // ring, indexed by stepno. only the old-format estimate and the report read it
+	Snapshot snapshot; // quantized view of <state>, built once per step
+	std::deque<EncodedDelta> encoded; // this step's, for clients to share. a deque so the workers' pointers into it stay good
+	std::mutex encoded_mutex;
+	Bandwidth bandwidth; // since the last report, from clients that have left since
+	lmp::Traffic received; // since the last report
+	std::map<std::string, TaskTime> timing; // since the last report, by task name
+	std::mutex timing_mutex;
 	std::vector<Client> client_list;
-	int gameover_timer, win_timer;
+
+	Broadcaster broadcaster; // for the spectators
+
+	// lockstep mode
+	const bool lockstep;
+	std::uint32_t match_start; // step the match (re)started at, whenever somebody joined or left
+	std::deque<lmp::Lockstep::Tick> ticks; // recent steps' inputs, oldest first
+	std::uint32_t ticks_first; // step of ticks.front()
+	std::uint32_t checksum_step; // latest step with a checksum, 0 for none yet
+	std::uint32_t checksum;
 
 	mersenne random; // prng
+	const std::uint64_t seed; // keys the simulation's prngs
+	const int stats_interval; // seconds between reports, 0 for none
+	const int client_rate; // bytes per second to each client, 0 for no cap
+	const int snapshot_rate; // datagrams per second to each client
+	std::uint32_t input_frames; // input frames played so far. clients send one per BASE_TICK step, whatever the tick
+	int input_clock; // BASE_TICK steps' worth of input owed, in 1/World::tick units
+	Workers workers; // for the simulation
+	const std::uint64_t cookie_key; // keys the stateless udp join cookies
+	std::map<std::int32_t, int> spent; // cookies of clients kicked for falling behind, by when. they'd walk right back in
 	std::atomic<bool> running; // flag to tell server to exit
 
 	net::tcp_server tcp;
 	net::udp_server udp;
+	std::vector<net::udp_server> shards; // more sockets on the same port (SO_REUSEPORT). the kernel sticks each address to one
+	std::vector<Inbox> inboxes; // one for udp and each of <shards>
+	net::waiter waiter; // what the service thread sleeps on while nobody is connected
 
 	std::chrono::time_point<std::chrono::high_resolution_clock> last; // time point of last simulation step
 	std::thread background; // handle for service thread
 };
 
+// how long an entity has been waiting to go out to one client, weighted by how much it matters to them
+struct Priority
+{
+	Entity::Type kind;
+	std::int32_t id;
+	float accumulated;
+};
+
 struct Client
 {
 	Client(std::int32_t ident, std::int32_t sec)
 	: stepno(0)
+	, input_step(0)
+	, bytes_sent(0)
 	, id(ident)
 	, secret(sec)
 	, paused(false)
 	, last_datagram_time(0)
+	, allowance(0)
+	, behind(false)
+	, connected(std::chrono::steady_clock::now())
+	, greeted(false)
+	, checksummed(0)
+	, echo(0)
+	, echo_time(0)
 	{}
 
 	Player &player(std::vector<Player> &list) const
@@ -72,6 +264,25 @@ struct Client
 		hcf("could not id player %d", id);
 	}
 
+	const Player &player(const std::vector<Player> &list) const
+	{
+		for(const auto &p : list)
+			if(p.id == id)
+				return p;
+
+		hcf("could not id player %d", id);
+	}
+
+	// what this client got for step <step>, NULL if it's gone
+	const Snapshot *baseline(std::uint32_t step) const
+	{
+		for(const Snapshot &snapshot : sent)
+			if(snapshot.stepno == step)
+				return &snapshot;
+
+		return NULL;
+	}
+
 	static Client *by_secret(std::int32_t s, std::vector<Client> &list)
 	{
 		for(auto &c : list)
@@ -84,13 +295,27 @@ struct Client
 	static int last_id;
 
 	Controls controls;
+	InputQueue inputs;
+	std::deque<Snapshot> sent; // what the client will have decoded for recent steps, oldest first
+	std::vector<std::int32_t> interest; // sorted ids of the asteroids in this client's view
+	std::vector<Priority> priority; // entities in view with changes pending, sorted by kind, then id
+	Bandwidth bandwidth; // since the last report
 
 	net::udp_id udpid;
 	std::uint32_t stepno;
+	std::uint32_t input_step; // newest input frame applied so far
+	unsigned long long bytes_sent; // since the last report
 	std::int32_t id;
 	std::int32_t secret;
 	bool paused;
-	int last_datagram_time;
+	std::int64_t last_datagram_time; // milliseconds()
+	int allowance; // bytes this client may still be sent under the rate cap
+	bool behind; // lockstep: needs steps that aren't kept anymore
+	std::chrono::steady_clock::time_point connected;
+	bool greeted; // has been sent its first datagram
+	std::uint32_t checksummed; // step the latest Checksum went out with
+	std::uint16_t echo; // ClientInfo::clock of the newest ClientInfo
+	std::int64_t echo_time; // milliseconds() it came in at, 0 for none yet
 };
 
 #endif // SERVER_H
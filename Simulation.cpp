@@ -0,0 +1,482 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Simulation.h"
+
+// what each keyed prng is for, so no two draws for the same entity and step share numbers
+enum Stream : std::uint32_t
+{
+	STREAM_FIRE,
+	STREAM_ASTEROID,
+	STREAM_SPLIT,
+	STREAM_SPAWN,
+	STREAM_SHIP
+};
+
+// what became of an asteroid this step
+enum class Fate : std::uint8_t
+{
+	NONE,
+	DESTROYED, // shot to pieces, scores
+	EXPLODED // fell apart on its own
+};
+
+// odds of one in <odds> per BASE_TICK step, as one in how many per step <delta> long
+static int per_step(int odds, float delta)
+{
+	return std::max(int(odds / delta), 1);
+}
+
+// asteroids bucketed by the grid cell their center is in
+class Grid
+{
+public:
+	explicit Grid(const std::vector<Asteroid> &list)
+	{
+		cells.reserve(list.size());
+		for(unsigned i = 0; i < list.size(); ++i)
+			cells.push_back({key(column(list[i].x + (list[i].w / 2)), row(list[i].y + (list[i].h / 2))), i});
+
+		std::sort(cells.begin(), cells.end());
+	}
+
+	// calls <visit> with the index of every asteroid whose center might be within <reach> of <subject>'s
+	template <typename F> void near(const Entity &subject, float reach, F visit) const
+	{
+		const float x = subject.x + (subject.w / 2);
+		const float y = subject.y + (subject.h / 2);
+
+		for(int r = row(y - reach); r <= row(y + reach); ++r)
+		{
+			for(int c = column(x - reach); c <= column(x + reach); ++c)
+			{
+				const std::uint64_t k = key(c, r);
+				for(auto it = std::lower_bound(cells.begin(), cells.end(), std::make_pair(k, 0u)); it != cells.end() && it->first == k; ++it)
+					visit(it->second);
+			}
+		}
+	}
+
+private:
+	// anything off the top or left edge goes in the first row or column
+	static int column(float x) { return std::max(int(std::floor((x - WORLD_LEFT) / GRID_CELL)), 0); }
+	static int row(float y) { return std::max(int(std::floor((y - WORLD_TOP) / GRID_CELL)), 0); }
+	static std::uint64_t key(int column, int row) { return (std::uint64_t(row) << 32) | std::uint32_t(column); }
+
+	std::vector<std::pair<std::uint64_t, unsigned>> cells; // (cell, asteroid index), sorted
+};
+
+// hovering over a dead player brings them back, a quarter of a percent per BASE_TICK step
+static void repair(Player &player, std::vector<Player> &players, float delta)
+{
+	bool colliding = false;
+	if(player.health > 0)
+	{
+		for(Player &other : players)
+		{
+			if(&player == &other || other.health > 0)
+				continue;
+
+			if(player.collide(other) && (player.repairing_id == -1 || player.repairing_id == other.id))
+			{
+				colliding = true;
+
+				player.shooting = false;
+				player.repairing_id = other.id;
+				player.percent_repair += 0.25f * delta;
+				if(player.percent_repair >= 100)
+				{
+					colliding = false;
+					other.health = 100;
+				}
+			}
+
+			break;
+		}
+	}
+
+	if(!colliding)
+	{
+		player.percent_repair = 0;
+		player.repairing_id = -1;
+	}
+}
+
+void simulate(GameState &state, const std::vector<Controls> &controls, std::uint64_t seed, Workers &workers)
+{
+	std::vector<Player> &players = state.player_list;
+	std::vector<Bullet> &bullets = state.bullet_list;
+	std::vector<Asteroid> &asteroids = state.asteroid_list;
+	std::vector<Ship> &ships = state.ship_list;
+	const std::uint32_t stepno = state.stepno;
+	const float delta = World::delta;
+
+	// wake up sectors near players, put the rest to sleep
+	state.update_sectors();
+
+	// *********
+	// INTEGRATE
+	// *********
+
+	for(unsigned i = 0; i < players.size(); ++i)
+		players[i].integrate(controls[i], delta);
+
+	// players patch each other up, then shoot. before the bullets move, so a new one flies and can hit something
+	// the step it's fired, as it always has
+	for(Player &player : players)
+	{
+		repair(player, players, delta);
+
+		if(player.shooting && player.timer_fire <= 0.0f && player.health > 0)
+		{
+			splitmix random(seed, stepno, player.id, STREAM_FIRE);
+			const float plusminus = 0.02f;
+
+			player.timer_idle = 0;
+			bullets.push_back({int(player.x + (PLAYER_WIDTH / 2)), int(player.y + (PLAYER_HEIGHT / 2)), player.rot + random(-plusminus, plusminus)});
+			player.timer_fire = PLAYER_TIMER_FIRE;
+		}
+	}
+
+	std::vector<std::uint8_t> gone(bullets.size()); // bullets that left the world
+
+	workers.parallel_for("integrate", bullets.size(), WORKERS_CHUNK, [&](unsigned i)
+	{
+		gone[i] = !bullets[i].move(delta);
+		bullets[i].ttl -= delta;
+	});
+
+	workers.parallel_for("integrate", asteroids.size(), WORKERS_CHUNK, [&](unsigned i)
+	{
+		asteroids[i].move(delta);
+	});
+
+	for(Ship &ship : ships)
+		ship.move(delta);
+
+	// *********
+	// BROADPHASE
+	// *********
+
+	const Grid grid(asteroids);
+	const float biggest = Asteroid::size(AsteroidType::BIG) / 2.0f;
+
+	std::vector<int> bullet_hit(bullets.size(), -1); // first asteroid (in list order) each bullet ran into
+	workers.parallel_for("broadphase", bullets.size(), WORKERS_CHUNK, [&](unsigned i)
+	{
+		if(gone[i])
+			return;
+
+		const Bullet &bullet = bullets[i];
+		int &hit = bullet_hit[i];
+		grid.near(bullet, BULLET_SIZE + biggest, [&](unsigned a)
+		{
+			if((hit == -1 || (int)a < hit) && bullet.collide(asteroids[a]))
+				hit = a;
+		});
+	});
+
+	std::vector<int> player_contacts(players.size(), 0); // asteroids grinding against each player
+	for(unsigned i = 0; i < players.size(); ++i)
+	{
+		const Player &player = players[i];
+		if(player.health > 0)
+			grid.near(player, PLAYER_WIDTH + biggest, [&](unsigned a){ player_contacts[i] += asteroids[a].collide(player, 10); });
+	}
+
+	std::vector<int> ship_contacts(ships.size(), 0);
+	for(unsigned i = 0; i < ships.size(); ++i)
+	{
+		const Ship &ship = ships[i];
+		if(ship.health > 0)
+			grid.near(ship, SHIP_WIDTH + biggest, [&](unsigned a){ ship_contacts[i] += asteroids[a].collide(ship); });
+	}
+
+	// *********
+	// RESOLVE
+	// *********
+
+	// bullet hits grouped by asteroid, each group in bullet order
+	std::vector<unsigned> hit_start(asteroids.size() + 1, 0);
+	for(const int hit : bullet_hit)
+		if(hit != -1)
+			++hit_start[hit + 1];
+	for(unsigned i = 1; i < hit_start.size(); ++i)
+		hit_start[i] += hit_start[i - 1];
+	std::vector<unsigned> hits(hit_start.back());
+	std::vector<unsigned> fill(hit_start.begin(), hit_start.end() - 1);
+	for(unsigned i = 0; i < bullets.size(); ++i)
+		if(bullet_hit[i] != -1)
+			hits[fill[bullet_hit[i]]++] = i;
+
+	// crowded sectors shed asteroids faster
+	std::vector<unsigned> population(World::sectors(), 0);
+	for(const Asteroid &aster : asteroids)
+		++population[World::sector(aster)];
+
+	std::vector<Fate> fate(asteroids.size(), Fate::NONE);
+	workers.parallel_for("resolve", asteroids.size(), WORKERS_CHUNK, [&](unsigned i)
+	{
+		Asteroid &aster = asteroids[i];
+		splitmix random(seed, stepno, aster.id, STREAM_ASTEROID);
+
+		for(unsigned h = hit_start[i]; h < hit_start[i + 1]; ++h)
+		{
+			const Bullet &bullet = bullets[hits[h]];
+
+			// align asteroid direction with bullet direction
+			targetf(&aster.xv, 1.0 / (aster.w / 30.0f), bullet.xv / 2.0);
+			targetf(&aster.yv, 1.0 / (aster.h / 30.0f), bullet.yv / 2.0);
+
+			aster.health -= random(4, 7);
+		}
+
+		if(aster.health < 1)
+		{
+			fate[i] = Fate::DESTROYED;
+			return;
+		}
+
+		// sometimes asteroids explode
+		const float probability_mult = population[World::sector(aster)] > 20 ? 1.0f : 0.5f;
+		int probability = 0;
+		if(aster.type == AsteroidType::BIG)
+			probability = 1800 * probability_mult;
+		else if(aster.type == AsteroidType::MED)
+			probability = 2200 * probability_mult;
+		else
+			probability = 1600;
+		if(random(per_step(probability, delta)))
+			fate[i] = Fate::EXPLODED;
+	});
+
+	for(unsigned i = 0; i < players.size(); ++i)
+	{
+		if(player_contacts[i] > 0)
+		{
+			players[i].health -= 2 * player_contacts[i] * delta;
+			players[i].timer_idle = 0;
+		}
+	}
+
+	// health is whole points, the fraction of a point a step does at a fast tick is carried until it adds up to one
+	for(unsigned i = 0; i < ships.size(); ++i)
+	{
+		Ship &ship = ships[i];
+		ship.wear += 2 * ship_contacts[i] * delta;
+		const int damage = (int)ship.wear;
+		ship.health -= damage;
+		ship.wear -= damage;
+	}
+
+	// *********
+	// APPLY
+	// *********
+
+	// bullets that hit something, ran out or left are done
+	unsigned kept = 0;
+	for(unsigned i = 0; i < bullets.size(); ++i)
+		if(!gone[i] && bullet_hit[i] == -1 && bullets[i].ttl > 0.0f)
+			bullets[kept++] = bullets[i];
+	bullets.erase(bullets.begin() + kept, bullets.end());
+
+	// asteroids that were shot or exploded make way for their pieces
+	std::vector<Asteroid> pieces;
+	kept = 0;
+	for(unsigned i = 0; i < asteroids.size(); ++i)
+	{
+		const Asteroid &aster = asteroids[i];
+		if(fate[i] == Fate::NONE)
+		{
+			asteroids[kept++] = aster;
+			continue;
+		}
+
+		if(fate[i] == Fate::DESTROYED)
+			state.score += Asteroid::score(aster.type);
+
+		const AsteroidType t = Asteroid::next(aster.type);
+		if(t == AsteroidType::NONE)
+			continue;
+
+		splitmix random(seed, stepno, aster.id, STREAM_SPLIT);
+		for(int k = 0; k < 3; ++k)
+		{
+			Asteroid piece(t, random, &aster, ++state.last_asteroid_id);
+			if(fate[i] == Fate::EXPLODED)
+			{
+				// augment its speed
+				const float angle = random(0.0, 2 * 3.1415926);
+				const int explode_speed = random(1.0, 3.0);
+
+				piece.xv = cosf(angle) * explode_speed;
+				piece.yv = sinf(angle) * explode_speed;
+			}
+
+			pieces.push_back(piece);
+		}
+	}
+	asteroids.erase(asteroids.begin() + kept, asteroids.end());
+	asteroids.insert(asteroids.end(), pieces.begin(), pieces.end());
+
+	// figure out potential # of asteroids in each awake sector, top up the ones running low
+	std::vector<int> potential(World::sectors(), 0);
+	for(const Asteroid &aster : asteroids)
+	{
+		const int sector = World::sector(aster);
+
+		if(aster.type == AsteroidType::BIG)
+			potential[sector] += 9;
+		else if(aster.type == AsteroidType::MED)
+			potential[sector] += 3;
+		else if(aster.type == AsteroidType::SMALL)
+			potential[sector] += 1;
+		else
+			hcf("invalid asteroid type");
+	}
+
+	// at most one per sector per BASE_TICK step, however fast the simulation runs
+	const bool refill = (std::uint64_t(stepno) * BASE_TICK) / World::tick != (std::uint64_t(stepno - 1) * BASE_TICK) / World::tick;
+	for(int sector = 0; sector < World::sectors() && refill; ++sector)
+	{
+		if(!state.active[sector] || potential[sector] > MAX_ASTEROIDS - 9)
+			continue;
+
+		splitmix random(seed, stepno, sector, STREAM_SPAWN);
+		Asteroid a(AsteroidType::BIG, random, NULL, ++state.last_asteroid_id);
+		if(World::sectors() > 1)
+		{
+			float left, top, right, bottom;
+			World::bounds(sector, left, top, right, bottom);
+			a.x = random(left, right);
+			a.y = random(top, bottom);
+		}
+
+		// make sure new guy is not colliding with any players
+		bool colliding = false;
+		for(const Player &player : players)
+		{
+			if(player.collide(a, -75))
+			{
+				colliding = true;
+				break;
+			}
+		}
+
+		// make sure new guy is not colliding with any ships
+		for(const Ship &ship : ships)
+		{
+			if(ship.collide(a, -100))
+			{
+				colliding = true;
+				break;
+			}
+		}
+
+		if(!colliding)
+			asteroids.push_back(a);
+	}
+
+	// ships that made it across score, ones that burned out cost
+	for(auto it = ships.begin(); it != ships.end();)
+	{
+		const Ship &ship = *it;
+
+		if(ship.health < 1 && ship.ttl <= 0.0f)
+		{
+			state.score -= 50;
+			it = ships.erase(it);
+			continue;
+		}
+
+		if((ship.xv > 0.0f && ship.x > WORLD_RIGHT + 1000) || (ship.xv < 0.0f && ship.x < WORLD_LEFT - 1000))
+		{
+			state.score += 50;
+			it = ships.erase(it);
+			continue;
+		}
+
+		++it;
+	}
+
+	splitmix random(seed, stepno, 0, STREAM_SHIP);
+	if(random(per_step(800, delta)) && ships.empty())
+		ships.push_back(Ship(random, ++state.last_ship_id));
+}
+
+// *********
+// *********
+// MATCH
+// *********
+// *********
+
+Match::Match()
+	: gameover_timer(TIMER_GAMEOVER)
+	, win_timer(TIMER_WIN)
+{}
+
+// <controls> lines up with state.player_list. <paused> is whether anybody has the game paused
+void Match::step(GameState &state, const std::vector<Controls> &controls, bool paused, std::uint64_t seed, Workers &workers)
+{
+	++state.stepno;
+
+	for(unsigned i = 0; i < state.player_list.size(); ++i)
+	{
+		state.player_list[i].shooting = controls[i].fire;
+		state.player_list[i].rot = controls[i].angle;
+	}
+
+	state.paused = paused;
+	if(paused)
+		return;
+
+	// see if players are all dead
+	bool gameover = true;
+	for(const Player &p : state.player_list)
+	{
+		if(p.health > 0)
+		{
+			gameover = false;
+			break;
+		}
+	}
+	if(gameover)
+	{
+		gameover_timer -= World::delta;
+		if(gameover_timer <= 0.0f)
+		{
+			state.reset();
+			gameover_timer = TIMER_GAMEOVER;
+		}
+	}
+
+	const bool over = won(state);
+	if(over)
+	{
+		win_timer -= World::delta;
+		if(win_timer <= 0.0f)
+		{
+			state.reset();
+			win_timer = TIMER_WIN;
+		}
+	}
+
+	simulate(state, controls, seed, workers);
+	if(over)
+	{
+		state.asteroid_list.clear();
+		state.dormant.clear();
+		state.ship_list.clear();
+	}
+}
+
+bool Match::won(const GameState &state)
+{
+	for(const Player &p : state.player_list)
+	{
+		if(p.health < 1)
+			return false;
+	}
+
+	return state.score >= MAX_SCORE && state.ship_list.size() == 0;
+}
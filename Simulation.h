@@ -0,0 +1,34 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "GameState.h"
+#include "Workers.h"
+
+#define GRID_CELL 128 // broadphase cell size, a bit bigger than the biggest asteroid
+#define MAX_SCORE 500 // to win, once the cruiser is through
+#define TIMER_GAMEOVER 400 // BASE_TICK steps
+#define TIMER_WIN 700
+
+// the server's authoritative step, in phases:
+//   integrate: everything moves, each entity on its own
+//   broadphase: asteroids go in a grid, and whatever can run into one looks up what's near it
+//   resolve: hits are settled per target, in a fixed order
+//   apply: scores, spawns and removals, serially, in list order
+// the first three run across <workers>. randomness comes from splitmix keyed by (<seed>, step, entity, purpose),
+// so for the same seed and inputs the result is bit identical whatever the worker count.
+// each step is World::delta long, speeds, timers and odds are scaled to match
+// <controls> lines up with state.player_list
+void simulate(GameState&, const std::vector<Controls>&, std::uint64_t, Workers&);
+
+// the match rules around simulate(): pausing, game over and winning, one step at a time.
+// the server runs it, and so does a lockstep client, so it mustn't look at anything it isn't passed
+struct Match
+{
+	Match();
+	void step(GameState&, const std::vector<Controls>&, bool, std::uint64_t, Workers&);
+	static bool won(const GameState&);
+
+	float gameover_timer, win_timer; // in BASE_TICK steps
+};
+
+#endif // SIMULATION_H
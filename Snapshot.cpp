@@ -0,0 +1,653 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#include "Snapshot.h"
+
+static const Entity::Type kinds[] = { Entity::Type::PLAYER, Entity::Type::ASTEROID, Entity::Type::SHIP };
+
+// integer division, rounded to nearest
+static std::int64_t div_round(std::int64_t n, std::int64_t d)
+{
+	return n >= 0 ? (n + (d / 2)) / d : -((-n + (d / 2)) / d);
+}
+
+// *********
+// *********
+// RECORD
+// *********
+// *********
+
+Record::Record()
+	: kind(Entity::Type::PLAYER)
+	, id(0)
+	, field{}
+{}
+
+Record::Record(const Player &subject)
+	: kind(Entity::Type::PLAYER)
+	, id(subject.id)
+	, field{}
+{
+	field[X] = position(subject.x);
+	field[Y] = position(subject.y);
+	field[XV] = velocity(subject.xv);
+	field[YV] = velocity(subject.yv);
+	field[ROT] = angle(subject.rot);
+	field[HEALTH] = std::lround(subject.health);
+	field[FLAGS] = subject.shooting;
+}
+
+Record::Record(const Asteroid &subject)
+	: kind(Entity::Type::ASTEROID)
+	, id(subject.id)
+	, field{}
+{
+	// the client steps it once more after integrating
+	field[SUBTYPE] = (int)subject.type;
+	field[X] = position(subject.x - subject.xv);
+	field[Y] = position(subject.y - subject.yv);
+	field[XV] = velocity(subject.xv);
+	field[YV] = velocity(subject.yv);
+}
+
+Record::Record(const Ship &subject)
+	: kind(Entity::Type::SHIP)
+	, id(subject.id)
+	, field{}
+{
+	field[X] = position(subject.x);
+	field[Y] = position(subject.y);
+	field[XV] = velocity(subject.xv);
+	field[YV] = velocity(subject.yv);
+	field[HEALTH] = subject.health;
+}
+
+// where the client will think this is <steps> steps later, if it hears nothing new.
+// players aren't extrapolated client side, asteroids and live ships are
+Record Record::predict(int steps) const
+{
+	Record r = *this;
+
+	if(extrapolated())
+	{
+		// velocities are per BASE_TICK step
+		const std::int64_t per = std::int64_t(VELOCITY_SCALE) * World::tick;
+		r.field[X] += div_round(std::int64_t(field[XV]) * steps * POSITION_SCALE * BASE_TICK, per);
+		r.field[Y] += div_round(std::int64_t(field[YV]) * steps * POSITION_SCALE * BASE_TICK, per);
+	}
+
+	return r;
+}
+
+bool Record::extrapolated() const
+{
+	return kind == Entity::Type::ASTEROID || (kind == Entity::Type::SHIP && field[HEALTH] > 0);
+}
+
+// fnv-1a over every quantized field
+std::uint32_t Record::hash() const
+{
+	std::uint32_t hash = 2166136261u;
+	const auto mix = [&hash](std::int32_t value)
+	{
+		for(int i = 0; i < 4; ++i)
+		{
+			hash ^= (value >> (i * 8)) & 0xff;
+			hash *= 16777619u;
+		}
+	};
+
+	mix((int)kind);
+	mix(id);
+	for(const std::int32_t f : field)
+		mix(f);
+
+	return hash;
+}
+
+bool Record::operator<(const Record &rhs) const
+{
+	if(kind != rhs.kind)
+		return kind < rhs.kind;
+
+	return id < rhs.id;
+}
+
+bool Record::operator==(const Record &rhs) const
+{
+	return kind == rhs.kind && id == rhs.id && std::equal(std::begin(field), std::end(field), std::begin(rhs.field));
+}
+
+std::int32_t Record::position(float f)
+{
+	return std::lround(f * POSITION_SCALE);
+}
+
+// clamped to what a CompactRecord holds
+std::int32_t Record::velocity(float f)
+{
+	const long v = std::lround(f * VELOCITY_SCALE);
+
+	return v > 32767 ? 32767 : v < -32767 ? -32767 : v;
+}
+
+std::int32_t Record::angle(float f)
+{
+	const float turns = f / (3.1415926f * 2.0f);
+	const std::int32_t a = std::lround((turns - std::floor(turns)) * SNAPSHOT_ANGLE_SCALE);
+
+	return a % SNAPSHOT_ANGLE_SCALE;
+}
+
+float Record::position(std::int32_t i)
+{
+	return i / (float)POSITION_SCALE;
+}
+
+float Record::velocity(std::int32_t i)
+{
+	return i / (float)VELOCITY_SCALE;
+}
+
+float Record::angle(std::int32_t i)
+{
+	return (i / (float)SNAPSHOT_ANGLE_SCALE) * 3.1415926f * 2.0f;
+}
+
+// *********
+// *********
+// SNAPSHOT
+// *********
+// *********
+
+Snapshot::Snapshot()
+	: stepno(0)
+	, score(0)
+	, paused(false)
+	, checksum(0)
+{}
+
+Snapshot::Snapshot(const GameState &state)
+	: stepno(state.stepno)
+	, score(state.score)
+	, paused(state.paused)
+	, checksum(0)
+{
+	records.reserve(state.player_list.size() + state.asteroid_list.size() + state.ship_list.size());
+
+	for(const Player &p : state.player_list)
+		add(p);
+	for(const Asteroid &a : state.asteroid_list)
+		add(a);
+
+	// sleeping asteroids hold still
+	for(const std::vector<Asteroid> &sector : state.dormant)
+	{
+		for(const Asteroid &a : sector)
+		{
+			Record r = a;
+			r.field[Record::X] = Record::position(a.x);
+			r.field[Record::Y] = Record::position(a.y);
+			r.field[Record::XV] = 0;
+			r.field[Record::YV] = 0;
+			add(r);
+		}
+	}
+	for(const Ship &s : state.ship_list)
+		add(s);
+
+	std::sort(records.begin(), records.end());
+}
+
+// appends <record>, and counts it into the checksum. the records still have to end up sorted
+void Snapshot::add(const Record &record)
+{
+	records.push_back(record);
+	checksum += record.hash();
+}
+
+// the checksums go first, they tell most snapshots apart without walking the records
+bool Snapshot::operator==(const Snapshot &rhs) const
+{
+	return checksum == rhs.checksum && stepno == rhs.stepno && score == rhs.score && paused == rhs.paused && records == rhs.records;
+}
+
+// *********
+// *********
+// COMPACT
+// *********
+// *********
+
+CompactRecord::CompactRecord(const Record &record)
+	: id(record.id)
+	, x(record.field[Record::X])
+	, y(record.field[Record::Y])
+	, xv(record.field[Record::XV])
+	, yv(record.field[Record::YV])
+	, health(record.field[Record::HEALTH])
+	, rot(record.field[Record::ROT])
+	, kind((std::uint8_t)record.kind)
+	, subtype(record.field[Record::SUBTYPE])
+	, flags(record.field[Record::FLAGS])
+{}
+
+Record CompactRecord::expand() const
+{
+	Record record;
+
+	record.kind = (Entity::Type)kind;
+	record.id = id;
+	record.field[Record::SUBTYPE] = subtype;
+	record.field[Record::X] = x;
+	record.field[Record::Y] = y;
+	record.field[Record::XV] = xv;
+	record.field[Record::YV] = yv;
+	record.field[Record::ROT] = rot;
+	record.field[Record::HEALTH] = health;
+	record.field[Record::FLAGS] = flags;
+
+	return record;
+}
+
+CompactSnapshot::CompactSnapshot()
+	: stepno(0)
+	, score(0)
+	, paused(false)
+{}
+
+void CompactSnapshot::pack(const Snapshot &snapshot)
+{
+	stepno = snapshot.stepno;
+	score = snapshot.score;
+	paused = snapshot.paused;
+	records.assign(snapshot.records.begin(), snapshot.records.end());
+}
+
+// memory held, including spare capacity
+std::size_t CompactSnapshot::bytes() const
+{
+	return sizeof(*this) + (records.capacity() * sizeof(CompactRecord));
+}
+
+// *********
+// *********
+// DELTA CODING
+// *********
+// *********
+
+// for each entity type:
+//   updates: { 1, id, new?, field mask, (signed delta from predicted baseline value) for each field in the mask } ... 0
+//   removes: { 1, id, culled? } ... 0
+// ids are sorted, so after the first one only the gap goes out
+static void write_id(lmp::bitwriter &writer, bool first, std::int32_t id, std::int32_t previous)
+{
+	if(first)
+		writer.write_signed(id);
+	else
+		writer.write_unsigned(id - previous - 1);
+}
+
+static std::int32_t read_id(lmp::bitreader &reader, bool first, std::int32_t previous)
+{
+	if(first)
+		return reader.read_signed();
+
+	return previous + 1 + reader.read_unsigned();
+}
+
+// a change that wants to go out, in the order it would be written
+struct Candidate
+{
+	Entity::Type kind;
+	std::int32_t id;
+	unsigned index; // into current.records for updates, base.records for removes
+	Record predicted;
+	std::uint32_t mask;
+	unsigned cost; // bits, with the id at full price
+	unsigned id_bits; // of <cost>
+	float priority;
+	bool remove;
+	bool is_new; // updates
+	bool culled; // removes
+	bool chosen;
+};
+
+// exact bits the chosen candidates take, ids coded as gaps
+static unsigned chosen_bits(const std::vector<Candidate> &candidates)
+{
+	unsigned bits = 0;
+	bool first = true;
+	std::int32_t previous = 0;
+	for(unsigned i = 0; i < candidates.size(); ++i)
+	{
+		const Candidate &candidate = candidates[i];
+		if(i > 0 && (candidate.kind != candidates[i - 1].kind || candidate.remove != candidates[i - 1].remove))
+			first = true;
+		if(!candidate.chosen)
+			continue;
+
+		bits += candidate.cost - candidate.id_bits;
+		bits += first ? lmp::bitwriter::signed_bits(candidate.id) : lmp::bitwriter::unsigned_bits(candidate.id - previous - 1);
+		first = false;
+		previous = candidate.id;
+	}
+
+	return bits;
+}
+
+// <sent> gets what the client will have after decoding this, which is what the next delta should be made against.
+// it can be a little off from <current>: extrapolated positions within POSITION_TOLERANCE of the truth are left alone.
+// <current> may be a filtered view of <world>. entities that are still in <world> are removed as culled, not destroyed.
+// the changes go out in priority order until <writer> is full. removes come first, then updates by <priority>
+// (parallel to current.records, highest first; list order without it). what doesn't fit is deferred: <sent> keeps
+// the baseline's idea of it, so a later delta picks it up. <priority> is zeroed for whatever the client is now up to date on
+void encode_delta(const Snapshot &base, const Snapshot &current, const Snapshot &world, lmp::bitwriter &writer, Snapshot &sent, DeltaStats &stats, std::vector<float> *priority)
+{
+	const int steps = current.stepno - base.stepno;
+
+	sent.records.clear();
+	sent.records.reserve(current.records.size());
+	sent.checksum = 0;
+
+	// everything that differs from what the client will predict
+	std::vector<Candidate> candidates;
+	for(const Entity::Type kind : kinds)
+	{
+		auto base_it = base.records.begin();
+		const auto base_end = base.records.end();
+
+		for(unsigned i = 0; i < current.records.size(); ++i)
+		{
+			const Record &record = current.records[i];
+			if(record.kind != kind)
+				continue;
+
+			while(base_it != base_end && *base_it < record)
+				++base_it;
+			const bool is_new = base_it == base_end || base_it->kind != kind || base_it->id != record.id;
+
+			const Record predicted = is_new ? Record() : base_it->predict(steps);
+
+			std::uint32_t mask = 0;
+			for(int f = 0; f < Record::FIELD_COUNT; ++f)
+				if(record.field[f] != predicted.field[f])
+					mask |= 1 << f;
+
+			// close enough
+			if(!is_new && predicted.extrapolated() && (mask & ~((1 << Record::X) | (1 << Record::Y))) == 0 &&
+				std::abs(record.field[Record::X] - predicted.field[Record::X]) <= POSITION_TOLERANCE &&
+				std::abs(record.field[Record::Y] - predicted.field[Record::Y]) <= POSITION_TOLERANCE)
+			{
+				mask = 0;
+			}
+
+			if(!is_new && mask == 0)
+			{
+				sent.add(predicted);
+				if(priority != NULL)
+					(*priority)[i] = 0.0f;
+				continue;
+			}
+
+			Candidate candidate;
+			candidate.kind = kind;
+			candidate.id = record.id;
+			candidate.index = i;
+			candidate.predicted = predicted;
+			candidate.mask = mask;
+			candidate.id_bits = lmp::bitwriter::signed_bits(record.id);
+			candidate.cost = 1 + 1 + Record::FIELD_COUNT + candidate.id_bits;
+			for(int f = 0; f < Record::FIELD_COUNT; ++f)
+				if(mask & (1 << f))
+					candidate.cost += lmp::bitwriter::signed_bits(record.field[f] - predicted.field[f]);
+			candidate.priority = priority != NULL ? (*priority)[i] : 0.0f;
+			candidate.remove = false;
+			candidate.is_new = is_new;
+			candidate.culled = false;
+			candidate.chosen = false;
+			candidates.push_back(candidate);
+		}
+
+		auto current_it = current.records.begin();
+		const auto current_end = current.records.end();
+		for(unsigned i = 0; i < base.records.size(); ++i)
+		{
+			const Record &record = base.records[i];
+			if(record.kind != kind)
+				continue;
+
+			while(current_it != current_end && *current_it < record)
+				++current_it;
+			if(current_it != current_end && current_it->kind == kind && current_it->id == record.id)
+				continue;
+
+			Candidate candidate;
+			candidate.kind = kind;
+			candidate.id = record.id;
+			candidate.index = i;
+			candidate.mask = 0;
+			candidate.id_bits = lmp::bitwriter::signed_bits(record.id);
+			candidate.cost = 1 + 1 + candidate.id_bits;
+			candidate.priority = std::numeric_limits<float>::max();
+			candidate.remove = true;
+			candidate.is_new = false;
+			candidate.culled = &current != &world && std::binary_search(world.records.begin(), world.records.end(), record);
+			candidate.chosen = false;
+			candidates.push_back(candidate);
+		}
+	}
+
+	// with this much room, the first pass below takes everything in whatever order
+	const unsigned terminators = 3 * 2; // end of updates and removes for each type
+	stats.room = terminators;
+	for(const Candidate &candidate : candidates)
+		stats.room += candidate.cost;
+
+	// fill the room in priority order. ids are priced as if they were first in line, which they rarely are,
+	// so whatever that overestimate leaves gets offered to what was passed over
+	std::vector<unsigned> order(candidates.size());
+	for(unsigned i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&candidates](unsigned a, unsigned b)
+	{
+		return candidates[a].priority > candidates[b].priority;
+	});
+
+	const unsigned budget = writer.room() > terminators ? writer.room() - terminators : 0;
+	unsigned used = 0;
+	for(int pass = 0; pass < 4; ++pass)
+	{
+		bool added = false;
+		for(const unsigned i : order)
+		{
+			Candidate &candidate = candidates[i];
+			if(candidate.chosen || used + candidate.cost > budget)
+				continue;
+
+			candidate.chosen = true;
+			used += candidate.cost;
+			added = true;
+		}
+
+		if(!added)
+			break;
+		used = chosen_bits(candidates);
+	}
+
+	// and write them, in id order
+	unsigned next = 0;
+	for(const Entity::Type kind : kinds)
+	{
+		const int index = (int)kind;
+
+		// updates
+		const unsigned start = writer.bits();
+		bool first = true;
+		std::int32_t previous = 0;
+		for(; next < candidates.size() && candidates[next].kind == kind && !candidates[next].remove; ++next)
+		{
+			const Candidate &candidate = candidates[next];
+			const Record &record = current.records[candidate.index];
+
+			if(!candidate.chosen)
+			{
+				if(!candidate.is_new)
+					sent.add(candidate.predicted);
+				++stats.deferred;
+				continue;
+			}
+
+			sent.add(record);
+			if(priority != NULL)
+				(*priority)[candidate.index] = 0.0f;
+
+			writer.write(1, 1);
+			write_id(writer, first, record.id, previous);
+			writer.write(candidate.is_new, 1);
+			writer.write(candidate.mask, Record::FIELD_COUNT);
+			for(int f = 0; f < Record::FIELD_COUNT; ++f)
+				if(candidate.mask & (1 << f))
+					writer.write_signed(record.field[f] - candidate.predicted.field[f]);
+
+			first = false;
+			previous = record.id;
+			++stats.updates[index];
+		}
+		writer.write(0, 1);
+		stats.bits[index] += writer.bits() - start;
+
+		// removes
+		const unsigned remove_start = writer.bits();
+		first = true;
+		previous = 0;
+		for(; next < candidates.size() && candidates[next].kind == kind && candidates[next].remove; ++next)
+		{
+			const Candidate &candidate = candidates[next];
+			const Record &record = base.records[candidate.index];
+
+			if(!candidate.chosen)
+			{
+				sent.add(record.predict(steps));
+				++stats.deferred;
+				continue;
+			}
+
+			writer.write(1, 1);
+			write_id(writer, first, record.id, previous);
+			writer.write(candidate.culled, 1);
+
+			first = false;
+			previous = record.id;
+			++stats.removes;
+		}
+		writer.write(0, 1);
+		stats.remove_bits += writer.bits() - remove_start;
+	}
+
+	std::sort(sent.records.begin(), sent.records.end());
+}
+
+// rebuilds <out> (whose stepno must already be set) from <base> and the packed changes.
+// <updated> gets the records that were actually sent, <removed> the entities that went away and <culled> the ones
+// that only went out of view.
+// returns false on garbage
+bool decode_delta(const Snapshot &base, lmp::bitreader &reader, Snapshot &out, std::vector<const Record*> &updated, std::vector<Entity::Reference> &removed, std::vector<Entity::Reference> &culled)
+{
+	const int steps = out.stepno - base.stepno;
+
+	out.records.clear();
+	out.checksum = 0;
+	std::vector<unsigned> updated_index;
+
+	for(const Entity::Type kind : kinds)
+	{
+		// updates
+		std::vector<Record> updates;
+		bool first = true;
+		std::int32_t previous = 0;
+		while(reader.read(1) == 1)
+		{
+			Record record;
+			record.kind = kind;
+			record.id = read_id(reader, first, previous);
+			first = false;
+			previous = record.id;
+
+			const bool is_new = reader.read(1) == 1;
+			if(!is_new)
+			{
+				const auto it = std::lower_bound(base.records.begin(), base.records.end(), record);
+				if(it == base.records.end() || it->kind != kind || it->id != record.id)
+					return false;
+
+				record = it->predict(steps);
+			}
+
+			const std::uint32_t mask = reader.read(Record::FIELD_COUNT);
+			for(int i = 0; i < Record::FIELD_COUNT; ++i)
+				if(mask & (1 << i))
+					record.field[i] += reader.read_signed();
+
+			if(reader.overrun)
+				return false;
+
+			updates.push_back(record);
+		}
+
+		// removes
+		std::vector<std::int32_t> removes;
+		first = true;
+		previous = 0;
+		while(reader.read(1) == 1)
+		{
+			previous = read_id(reader, first, previous);
+			first = false;
+			const bool is_culled = reader.read(1) == 1;
+
+			if(reader.overrun)
+				return false;
+
+			removes.push_back(previous);
+			(is_culled ? culled : removed).push_back({kind, previous});
+		}
+
+		// merge the (extrapolated) baseline with the updates, leaving out the removes
+		auto update_it = updates.begin();
+		auto remove_it = removes.begin();
+		for(const Record &record : base.records)
+		{
+			if(record.kind != kind)
+				continue;
+
+			while(update_it != updates.end() && update_it->id < record.id)
+			{
+				updated_index.push_back(out.records.size());
+				out.add(*update_it++);
+			}
+
+			while(remove_it != removes.end() && *remove_it < record.id)
+				++remove_it;
+
+			if(update_it != updates.end() && update_it->id == record.id)
+			{
+				updated_index.push_back(out.records.size());
+				out.add(*update_it++);
+			}
+			else if(remove_it == removes.end() || *remove_it != record.id)
+				out.add(record.predict(steps));
+		}
+
+		while(update_it != updates.end())
+		{
+			updated_index.push_back(out.records.size());
+			out.add(*update_it++);
+		}
+	}
+
+	for(const unsigned index : updated_index)
+		updated.push_back(&out.records[index]);
+
+	return !reader.overrun;
+}
@@ -0,0 +1,125 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <vector>
+
+#include "Lump.h"
+#include "GameState.h"
+
+#define POSITION_SCALE 4 // positions go out in 1/4 units
+#define VELOCITY_SCALE 256 // velocities go out in 1/256 units per BASE_TICK step
+#define SNAPSHOT_ANGLE_SCALE 1024 // angles go out in 1/1024 turns
+#define POSITION_TOLERANCE 1 // extrapolated positions this close (in 1/POSITION_SCALE units) to the truth aren't corrected
+
+// quantized view of one entity, as the client sees it
+struct Record
+{
+	enum Field
+	{
+		SUBTYPE,
+		X,
+		Y,
+		XV,
+		YV,
+		ROT,
+		HEALTH,
+		FLAGS,
+
+		FIELD_COUNT
+	};
+
+	Record();
+	Record(const Player&);
+	Record(const Asteroid&);
+	Record(const Ship&);
+
+	Record predict(int) const;
+	bool extrapolated() const;
+	std::uint32_t hash() const;
+	bool operator<(const Record&) const;
+	bool operator==(const Record&) const;
+
+	static std::int32_t position(float);
+	static std::int32_t velocity(float);
+	static std::int32_t angle(float);
+	static float position(std::int32_t);
+	static float velocity(std::int32_t);
+	static float angle(std::int32_t);
+
+	Entity::Type kind;
+	std::int32_t id;
+	std::int32_t field[FIELD_COUNT];
+};
+
+// quantized view of the whole world at one step
+struct Snapshot
+{
+	Snapshot();
+	explicit Snapshot(const GameState&);
+	void add(const Record&);
+	bool operator==(const Snapshot&) const;
+
+	std::vector<Record> records; // sorted by kind, then id
+	std::uint32_t stepno;
+	std::int32_t score;
+	bool paused;
+	std::uint32_t checksum; // sum of the records' hashes, kept up by add(). order doesn't change it
+};
+
+// a Record packed down for keeping around. lossless, every quantized field fits
+struct CompactRecord
+{
+	CompactRecord() = default;
+	CompactRecord(const Record&);
+	Record expand() const;
+
+	std::int32_t id;
+	std::int32_t x, y;
+	std::int16_t xv, yv;
+	std::int16_t health;
+	std::uint16_t rot;
+	std::uint8_t kind;
+	std::uint8_t subtype;
+	std::uint8_t flags;
+};
+
+// a Snapshot packed down for the server's history ring. all of a step's records sit in one block,
+// which pack() reuses from one step to the next
+struct CompactSnapshot
+{
+	CompactSnapshot();
+	void pack(const Snapshot&);
+	std::size_t bytes() const;
+
+	std::vector<CompactRecord> records; // sorted by kind, then id
+	std::uint32_t stepno;
+	std::int32_t score;
+	bool paused;
+};
+
+// per-entity-type output of the encoder, for bandwidth accounting
+struct DeltaStats
+{
+	DeltaStats()
+		: bits{0, 0, 0}
+		, updates{0, 0, 0}
+		, remove_bits(0)
+		, removes(0)
+		, deferred(0)
+		, room(0)
+	{}
+
+	unsigned changes() const { return updates[0] + updates[1] + updates[2] + removes; }
+
+	unsigned bits[3]; // indexed by Entity::Type
+	unsigned updates[3];
+	unsigned remove_bits;
+	unsigned removes;
+	unsigned deferred; // updates and removes that didn't fit, left for a later datagram
+	unsigned room; // bits a writer needs for nothing to be deferred, whatever the priorities
+};
+
+void encode_delta(const Snapshot&, const Snapshot&, const Snapshot&, lmp::bitwriter&, Snapshot&, DeltaStats&, std::vector<float>* = NULL);
+bool decode_delta(const Snapshot&, lmp::bitreader&, Snapshot&, std::vector<const Record*>&, std::vector<Entity::Reference>&, std::vector<Entity::Reference>&);
+
+#endif // SNAPSHOT_H
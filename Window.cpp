@@ -1,3 +1,5 @@
+#include <cmath>
+
 #include <QApplication>
 #include <QPainter>
 #include <QTimer>
@@ -7,11 +9,13 @@
 #include "Window.h"
 
 #define GAMEPAD_TOLERANCE 0.2f
+#define SOUND_RANGE 1200.0f // effects further than this from the player aren't heard
 
-Window::Window(Assets::PackType pack, const std::string &addr, int secret)
+Window::Window(Assets::PackType pack, net::udp &&udp, int secret)
 	: axis_x(0)
 	, axis_y(0)
 	, gamepad_mode(false)
+	, show_metrics(false)
 	, font_announcement("sans-serif", 20)
 	, font_fps("sans-serif", 10)
 	, font_health("sans-serif", 12)
@@ -21,7 +25,7 @@ Window::Window(Assets::PackType pack, const std::string &addr, int secret)
 	, fm_health(font_health)
 	, fm_score(font_score)
 	, assets(pack)
-	, game(addr, secret)
+	, game(std::move(udp), secret)
 {
 	setCursor(Qt::CrossCursor);
 	resize(1000, 800);
@@ -54,6 +58,7 @@ void Window::step()
 {
 	game.input(controls);
 	game.step();
+	play_sounds();
 	// see if i'm timed out
 	if(game.timed_out())
 	{
@@ -64,6 +69,25 @@ void Window::step()
 	repaint();
 }
 
+// what the last step set off, quieter the further from the player, panned to where it happened
+void Window::play_sounds()
+{
+	const Player *const player = game.focus();
+	const float center_x = player ? player->x + (PLAYER_WIDTH / 2) : 0.0f;
+	const float center_y = player ? player->y + (PLAYER_HEIGHT / 2) : 0.0f;
+
+	for(const Sound &sound : game.sounds)
+	{
+		const float dx = sound.x - center_x;
+		const float dy = sound.y - center_y;
+		const float distance = sqrtf((dx * dx) + (dy * dy));
+		if(distance > SOUND_RANGE)
+			continue;
+
+		mixer.play(sound.effect, 1.0f - (distance / SOUND_RANGE), dx / (width() / 2.0f));
+	}
+}
+
 void Window::paintEvent(QPaintEvent*)
 {
 	QPainter painter(this);
@@ -85,8 +109,8 @@ void Window::paintEvent(QPaintEvent*)
 		float x = ship.x, y = ship.y;
 		game.adjust_coords(this, x, y);
 		const QPoint ship_center(x + (SHIP_WIDTH / 2), y + (SHIP_HEIGHT / 2));
-		const QPixmap &rotated = assets.ship[Assets::todeg(ship.xv > 0.0f ? 0 : 3.1415926)];
-		painter.drawPixmap(ship_center.x() - (rotated.width() / 2), ship_center.y() - (rotated.height() / 2), rotated.width(), rotated.height(), rotated);
+		const QImage &rotated = assets.ship[Assets::todeg(ship.xv > 0.0f ? 0 : 3.1415926)];
+		painter.drawImage(QRect(ship_center.x() - (rotated.width() / 2), ship_center.y() - (rotated.height() / 2), rotated.width(), rotated.height()), rotated);
 
 		// draw health
 		char health_str[10];
@@ -102,8 +126,8 @@ void Window::paintEvent(QPaintEvent*)
 		float x = aster.x, y = aster.y;
 		game.adjust_coords(this, x, y);
 		const QPoint aster_center(x + (aster.w / 2), y + (aster.h / 2));
-		const QPixmap &rotated = assets.asteroid(aster.type, aster.rot);
-		painter.drawPixmap(aster_center.x() - (rotated.width() / 2), aster_center.y() - (rotated.height() / 2), rotated.width(), rotated.height(), rotated);
+		const QImage &rotated = assets.asteroid(aster.type, aster.rot);
+		painter.drawImage(QRect(aster_center.x() - (rotated.width() / 2), aster_center.y() - (rotated.height() / 2), rotated.width(), rotated.height()), rotated);
 	}
 
 	// draw players
@@ -113,8 +137,8 @@ void Window::paintEvent(QPaintEvent*)
 		game.adjust_coords(this, x, y);
 		// painter.drawEllipse(x, y, player.w, player.h);
 		const QPoint player_center(x + (PLAYER_WIDTH / 2), y + (PLAYER_HEIGHT / 2));
-		const QPixmap &rotated = assets.player[Assets::todeg(player.rot + 3.1415926)];
-		painter.drawPixmap(player_center.x() - (rotated.width() / 2), player_center.y() - (rotated.height() / 2), rotated.width(), rotated.height(), rotated);
+		const QImage &rotated = assets.player[Assets::todeg(player.rot + 3.1415926)];
+		painter.drawImage(QRect(player_center.x() - (rotated.width() / 2), player_center.y() - (rotated.height() / 2), rotated.width(), rotated.height()), rotated);
 	}
 
 	// draw booletts
@@ -272,6 +296,55 @@ void Window::paintEvent(QPaintEvent*)
 		painter.drawText(QPointF(10.0, 10.0), fpsstr);
 	}
 	*/
+
+	if(show_metrics)
+		draw_metrics(painter);
+}
+
+// network counters over the last second, top left
+void Window::draw_metrics(QPainter &painter)
+{
+	const NetMetrics &metrics = game.metrics;
+	std::vector<std::string> lines;
+	char line[100];
+
+	const struct { const lmp::Traffic &traffic; const char *direction; } directions[] =
+	{
+		{ metrics.in, "in" },
+		{ metrics.out, "out" }
+	};
+	for(const auto &entry : directions)
+	{
+		snprintf(line, sizeof(line), "%-3s %3u datagrams/sec, %.2f KB/sec", entry.direction, entry.traffic.datagrams, entry.traffic.total / 1000.0);
+		lines.push_back(line);
+
+		for(int i = 0; i < lmp::Traffic::TYPES; ++i)
+		{
+			if(entry.traffic.lumps[i] == 0)
+				continue;
+
+			snprintf(line, sizeof(line), "    %-12s %3u lumps, %llu bytes", lmp::name((lmp::Type)i), entry.traffic.lumps[i], entry.traffic.bytes[i]);
+			lines.push_back(line);
+		}
+	}
+
+	snprintf(line, sizeof(line), "baselines %u hit, %u missed, %u full", metrics.baseline_hits, metrics.baseline_misses, metrics.full);
+	lines.push_back(line);
+	snprintf(line, sizeof(line), "%u stale, %u garbage, %u desyncs", metrics.stale, metrics.garbage, metrics.desyncs);
+	lines.push_back(line);
+	if(game.clock.synced())
+	{
+		snprintf(line, sizeof(line), "rtt %d ms, server at step %.1f", game.clock.rtt(), game.clock.server_step(milliseconds()));
+		lines.push_back(line);
+	}
+	const Mixer::Stats sfx_stats = mixer.stats();
+	snprintf(line, sizeof(line), "sfx %u/sec, %u dropped, latency %.1f ms average, %.1f ms worst", sfx_stats.events, sfx_stats.dropped, sfx_stats.average, sfx_stats.worst);
+	lines.push_back(line);
+
+	painter.setPen(assets.pen);
+	painter.setFont(font_fps);
+	for(unsigned i = 0; i < lines.size(); ++i)
+		painter.drawText(QPointF(10.0, 10.0 + ((i + 1) * fm_fps.height())), lines[i].c_str());
 }
 
 void Window::keyPressEvent(QKeyEvent *event)
@@ -330,6 +403,10 @@ void Window::process_keys(int key, bool press)
 			if(press)
 				sfx.playpause();
 			break;
+		case Qt::Key_F3:
+			if(press)
+				show_metrics = !show_metrics;
+			break;
 		case Qt::Key_Backspace:
 			if(press)
 				sfx.back();
@@ -6,100 +6,12 @@
 #include <QMediaPlaylist>
 #include <QDir>
 #include <QKeyEvent>
-#include <QPixmap>
+#include <QPainter>
 #include <QGamepadManager>
 
 #include "Asteroids.h"
-
-struct Assets
-{
-	enum class PackType
-	{
-		SIMPLE,
-		FANCY
-	};
-
-	Assets(PackType t)
-		: type(t)
-	{
-		// initialize asset pack variables
-		switch(type)
-		{
-			case PackType::SIMPLE:
-				path = "simple";
-				pen = QPen(Qt::black);
-				ship_health_pen = pen;
-				bullet_pen = pen;
-				pause_screen_text_pen = QPen(Qt::white);
-				health_brush = QBrush(Qt::black);
-				pause_screen_brush = QBrush(QColor(50, 50, 50, 200));
-				break;
-			case PackType::FANCY:
-				path = "fancy";
-				pen = QPen(Qt::white);
-				ship_health_pen = QPen(QColor(45, 245, 45));
-				bullet_pen = QPen(QColor(255, 255, 200));
-				pause_screen_text_pen = QPen(Qt::black);
-				health_brush = QBrush(Qt::white);
-				pause_screen_brush = QBrush(QColor(120, 120, 120, 100));
-				break;
-			default:
-				hcf("invalid pack type");
-				break;
-		}
-
-		// construct players
-		QPixmap initial_player(("assets/texture/" + path + "/player.png").c_str());
-		QPixmap initial_aster_big(("assets/texture/" + path + "/asteroid_big.png").c_str());
-		QPixmap initial_aster_med(("assets/texture/" + path + "/asteroid_med.png").c_str());
-		QPixmap initial_aster_small(("assets/texture/" + path + "/asteroid_small.png").c_str());
-		QPixmap initial_ship(("assets/texture/" + path + "/cruiser.png").c_str());
-
-		for(int i = 0; i < 360; ++i)
-		{
-			QTransform transform = QTransform().rotate(i);
-
-			player[i] = initial_player.transformed(transform, Qt::SmoothTransformation);
-			asteroid_big[i] = initial_aster_big.transformed(transform, Qt::SmoothTransformation);
-			asteroid_med[i] = initial_aster_med.transformed(transform, Qt::SmoothTransformation);
-			asteroid_small[i] = initial_aster_small.transformed(transform, Qt::SmoothTransformation);
-			ship[i] = initial_ship.transformed(transform, Qt::SmoothTransformation);
-		}
-	}
-
-	static int todeg(float rad)
-	{
-		while(rad < 0.0f)
-			rad += 3.1415926 * 2.0;
-		return (int)(rad * (180.0 / 3.1415926)) % 360;
-	}
-
-	QPixmap &asteroid(AsteroidType type, float rad)
-	{
-		switch(type)
-		{
-			case AsteroidType::BIG:
-				return asteroid_big[Assets::todeg(rad)];
-			case AsteroidType::MED:
-				return asteroid_med[Assets::todeg(rad)];
-			case AsteroidType::SMALL:
-				return asteroid_small[Assets::todeg(rad)];
-			default: break;
-		}
-
-		hcf("invalid asteroid type");
-	}
-
-	const PackType type;
-	std::string path;
-	QPen pen;
-	QPen ship_health_pen;
-	QPen bullet_pen;
-	QPen pause_screen_text_pen;
-	QBrush health_brush;
-	QBrush pause_screen_brush;
-	QPixmap player[360], asteroid_big[360], asteroid_med[360], asteroid_small[360], ship[360];
-};
+#include "Assets.h"
+#include "Mixer.h"
 
 struct Sfx : QObject
 {
@@ -191,7 +103,7 @@ private:
 class Window : public QWidget
 {
 public:
-	Window(Assets::PackType, const std::string&, int);
+	Window(Assets::PackType, net::udp&&, int);
 
 private:
 	void step();
@@ -211,9 +123,12 @@ private:
 	void gamepad_button_pause(bool);
 
 	static int text_width(const QFontMetrics&, const QString&);
+	void draw_metrics(QPainter&);
+	void play_sounds();
 
 	double axis_x, axis_y; // gamepad axis for right joystick
 	bool gamepad_mode;
+	bool show_metrics; // F3
 
 	QFont font_announcement;
 	QFont font_fps;
@@ -226,6 +141,7 @@ private:
 
 	Assets assets;
 	Sfx sfx;
+	Mixer mixer;
 	Asteroids game;
 	Controls controls;
 };
@@ -0,0 +1,161 @@
+#include "Workers.h"
+
+// which pool and worker the current thread belongs to
+static thread_local const Workers *current_pool = NULL;
+static thread_local int current_worker = 0;
+
+Workers::Workers(int count)
+	: queued(0)
+	, quit(false)
+{
+	if(count < 1)
+		count = 1;
+
+	for(int i = 0; i < count; ++i)
+		queues.emplace_back(new Queue);
+
+	for(int i = 1; i < count; ++i)
+		threads.emplace_back(Workers::loop, this, i);
+}
+
+Workers::~Workers()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for(std::thread &thread : threads)
+		thread.join();
+}
+
+void Workers::spawn(Group &group, const char *name, Task task)
+{
+	++group.pending;
+
+	Queue &queue = *queues[self()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back({std::move(task), &group, name});
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		++queued;
+	}
+	wake.notify_one();
+}
+
+// runs queued tasks (this group's or anybody's) until everything in <group> is done
+void Workers::wait(Group &group)
+{
+	const int me = self();
+
+	while(group.pending > 0)
+		if(!run_one(me))
+			std::this_thread::yield();
+}
+
+// calls <fn> once for each of [0, <count>), <grain> at a time per task, and returns when they're all done
+void Workers::parallel_for(const char *name, unsigned count, unsigned grain, const std::function<void(unsigned)> &fn)
+{
+	if(grain < 1)
+		grain = 1;
+
+	if(threads.empty() || count <= grain)
+	{
+		if(count > 0)
+			run(name, self(), [&]{ for(unsigned i = 0; i < count; ++i) fn(i); });
+
+		return;
+	}
+
+	Group group;
+	for(unsigned begin = 0; begin < count; begin += grain)
+	{
+		const unsigned end = begin + grain < count ? begin + grain : count;
+		spawn(group, name, [&fn, begin, end]{ for(unsigned i = begin; i < end; ++i) fn(i); });
+	}
+
+	wait(group);
+}
+
+// <hook> gets called after every task, from whichever thread ran it. set it before spawning anything
+void Workers::timing(Hook h)
+{
+	hook = std::move(h);
+}
+
+// newest of our own first, then the oldest of somebody else's
+bool Workers::run_one(int me)
+{
+	Job job;
+	bool found = false;
+
+	for(unsigned i = 0; i < queues.size() && !found; ++i)
+	{
+		Queue &queue = *queues[(me + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if(queue.jobs.empty())
+			continue;
+
+		if(i == 0)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+
+		found = true;
+	}
+
+	if(!found)
+		return false;
+
+	--queued;
+	run(job.name, me, job.task);
+	--job.group->pending;
+
+	return true;
+}
+
+void Workers::run(const char *name, int worker, const Task &task)
+{
+	if(!hook)
+	{
+		task();
+		return;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	task();
+	hook(name, worker, std::chrono::steady_clock::now() - start);
+}
+
+int Workers::self() const
+{
+	return current_pool == this ? current_worker : 0;
+}
+
+void Workers::loop(Workers *w, int index)
+{
+	Workers &workers = *w;
+	current_pool = w;
+	current_worker = index;
+
+	for(;;)
+	{
+		if(workers.run_one(index))
+			continue;
+
+		std::unique_lock<std::mutex> lock(workers.sleep_mutex);
+		workers.wake.wait(lock, [&workers]{ return workers.quit || workers.queued > 0; });
+		if(workers.quit)
+			return;
+	}
+}
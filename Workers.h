@@ -0,0 +1,73 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define WORKERS_CHUNK 64 // loop iterations per task when there's no better idea
+
+// work stealing job system with a fixed number of workers, picked at startup.
+// every worker has its own deque of tasks. it pushes and pops at the back, and when it runs dry it steals from the
+// front of the others'. the thread that owns the pool counts as worker 0, and whoever waits on a Group runs queued
+// tasks until that group is done, so tasks can fork and join more tasks themselves
+class Workers
+{
+public:
+	typedef std::function<void()> Task;
+	typedef std::function<void(const char*, int, std::chrono::nanoseconds)> Hook; // task name, worker, time it took
+
+	// tasks spawned into the same group are waited on together
+	struct Group
+	{
+		Group() : pending(0) {}
+
+		std::atomic<unsigned> pending;
+	};
+
+	explicit Workers(int);
+	~Workers();
+	Workers(const Workers&) = delete;
+	void operator=(const Workers&) = delete;
+
+	void spawn(Group&, const char*, Task);
+	void wait(Group&);
+	void parallel_for(const char*, unsigned, unsigned, const std::function<void(unsigned)>&);
+	void timing(Hook);
+	int count() const { return queues.size(); }
+
+private:
+	struct Job
+	{
+		Task task;
+		Group *group;
+		const char *name;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	static void loop(Workers*, int);
+	bool run_one(int);
+	void run(const char*, int, const Task&);
+	int self() const;
+
+	std::vector<std::unique_ptr<Queue>> queues; // one per worker
+	std::vector<std::thread> threads; // workers 1 and up
+	std::mutex sleep_mutex;
+	std::condition_variable wake; // something was queued, or it's time to quit
+	std::atomic<unsigned> queued; // jobs sitting in the queues
+	bool quit;
+	Hook hook;
+};
+
+#endif // WORKERS_H
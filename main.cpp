@@ -49,11 +49,11 @@ int run(QApplication &app)
 		server.reset(new Server);
 
 	// connect dialog
-	dlg::Connect connect(addr.length() > 0 ? addr : "127.0.0.1");
+	dlg::Connect connect(addr.length() > 0 ? addr : "127.0.0.1", greeter.udp_join(), greeter.spectate());
 	if(!connect.exec())
 		return 1;
 
-	Window window(get_asset_pack(), addr.length() > 0 ? addr : "127.0.0.1", connect.secret());
+	Window window(get_asset_pack(), std::move(connect.socket()), connect.secret());
 	window.show();
 
 	return app.exec();
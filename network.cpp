@@ -8,8 +8,22 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NET_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+#endif
+#endif // __linux__
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -41,6 +55,479 @@ static int get_errno(){
 #endif // _WIN32
 }
 
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+
+// io_uring. opt in with STBSRISRATES_IO_URING=1, linux only. there's no liburing to lean on, the rings are set up and
+// driven with the raw system calls.
+// one multishot receive (or accept) stays armed on the socket and the kernel fills registered buffers as datagrams
+// come in, so polling for them reads shared memory instead of making a system call that mostly says EWOULDBLOCK.
+// sends are queued and go to the kernel together, one io_uring_enter per flush().
+// anything the kernel doesn't support shows up as broken(), and the socket goes back to the plain calls
+#define URING_ENTRIES 256 // submission queue
+#define URING_COMPLETIONS 4096 // completion queue, room for a burst of datagrams between polls
+#define URING_BUFFERS 512 // registered receive buffers on a udp_server, a power of 2
+#define URING_CLIENT_BUFFERS 32 // on a udp, everything on it comes from the one server
+#define URING_BUFFER 2048 // bytes each, a datagram plus the header and address recvmsg puts in front of it
+#define URING_SENDS 1024 // sends in flight at once
+#define URING_DRAIN 100 // milliseconds teardown waits for what's in flight
+
+#ifdef NET_IO_URING
+
+class net::uring{
+public:
+	enum class mode{SERVER,CLIENT,LISTENER}; // udp_server, udp, tcp_server
+
+	uring(int,mode);
+	uring(const uring&)=delete;
+	~uring();
+	uring &operator=(const uring&)=delete;
+	static std::unique_ptr<uring> create(int,mode);
+	bool broken()const;
+	unsigned long long syscalls()const;
+	unsigned long long failed_sends()const;
+	int descriptor()const;
+	bool send(const void*,unsigned,const sockaddr*,socklen_t);
+	int recv(void*,unsigned,sockaddr_storage*,socklen_t*);
+	int accept();
+	void flush();
+
+private:
+	static const std::uint64_t ARMED=~0ull; // user_data of the multishot request, sends go by their slot
+	static const std::uint64_t CANCEL=~0ull-1;
+
+	struct outgoing{
+		msghdr header;
+		iovec iov;
+		sockaddr_storage addr;
+		unsigned char data[URING_BUFFER];
+	};
+
+	bool setup();
+	io_uring_sqe *next();
+	void arm();
+	void provide(unsigned);
+	void reap();
+	bool enter(unsigned,unsigned);
+
+	const int sock;
+	const mode kind;
+	const unsigned buffer_count; // URING_BUFFERS or URING_CLIENT_BUFFERS, none for a listener
+	std::atomic<unsigned long long> calls; // io_uring_enter, so far
+	std::atomic<unsigned long long> lost; // sends that completed with an error, so far
+	std::mutex mutex; // sends come from the workers
+
+	int fd;
+	void *sq_ring,*cq_ring;
+	std::size_t sq_bytes,cq_bytes;
+	io_uring_sqe *sqes;
+	unsigned sq_entries;
+	unsigned *sq_head,*sq_tail,*sq_mask,*sq_array;
+	unsigned *cq_head,*cq_tail,*cq_mask;
+	io_uring_cqe *cqes;
+	unsigned tail; // our copy of *sq_tail
+	unsigned unsubmitted; // in the submission queue, not in the kernel yet
+
+	bool armed; // the multishot request is still live
+	bool failed; // see broken()
+	msghdr armed_header; // what the multishot recvmsg fills in, per buffer
+	io_uring_buf_ring *buffer_ring;
+	unsigned short buffer_tail;
+	std::vector<unsigned char> buffers;
+	std::vector<unsigned> arrived; // buffer ids, oldest first from <next_arrived>
+	unsigned next_arrived;
+	std::vector<int> accepted;
+
+	std::vector<outgoing> slots; // made on the first send
+	std::vector<unsigned> idle;
+};
+
+net::uring::uring(int s,mode m)
+	:sock(s),kind(m),buffer_count(m==mode::SERVER?URING_BUFFERS:m==mode::CLIENT?URING_CLIENT_BUFFERS:0),calls(0),lost(0),fd(-1),
+	sq_ring(MAP_FAILED),cq_ring(MAP_FAILED),sq_bytes(0),cq_bytes(0),sqes((io_uring_sqe*)MAP_FAILED),sq_entries(0),sq_head(NULL),sq_tail(NULL),sq_mask(NULL),sq_array(NULL),cq_head(NULL),cq_tail(NULL),cq_mask(NULL),cqes(NULL),
+	tail(0),unsubmitted(0),armed(false),failed(false),buffer_ring((io_uring_buf_ring*)MAP_FAILED),buffer_tail(0),next_arrived(0){
+	memset(&armed_header,0,sizeof(armed_header));
+	armed_header.msg_namelen=sizeof(sockaddr_storage);
+}
+
+// NULL unless STBSRISRATES_IO_URING asks for it and the kernel goes along
+std::unique_ptr<net::uring> net::uring::create(int sock,mode m){
+	const char *const env=getenv("STBSRISRATES_IO_URING");
+	if(sock==-1||env==NULL||env[0]==0||!strcmp(env,"0"))
+		return NULL;
+
+	std::unique_ptr<uring> ring(new uring(sock,m));
+	if(!ring->setup())
+		return NULL;
+
+	return ring;
+}
+
+bool net::uring::setup(){
+	io_uring_params params;
+	memset(&params,0,sizeof(params));
+	params.flags=IORING_SETUP_CQSIZE;
+	params.cq_entries=URING_COMPLETIONS;
+	fd=syscall(__NR_io_uring_setup,URING_ENTRIES,&params);
+	if(fd<0){
+		fd=-1;
+		return false;
+	}
+
+	sq_bytes=params.sq_off.array+params.sq_entries*sizeof(unsigned);
+	cq_bytes=params.cq_off.cqes+params.cq_entries*sizeof(io_uring_cqe);
+	if(params.features&IORING_FEAT_SINGLE_MMAP)
+		sq_bytes=cq_bytes=sq_bytes>cq_bytes?sq_bytes:cq_bytes;
+
+	sq_ring=mmap(NULL,sq_bytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+	if(sq_ring==MAP_FAILED)
+		return false;
+	if(params.features&IORING_FEAT_SINGLE_MMAP)
+		cq_ring=sq_ring;
+	else if((cq_ring=mmap(NULL,cq_bytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING))==MAP_FAILED)
+		return false;
+	sqes=(io_uring_sqe*)mmap(NULL,params.sq_entries*sizeof(io_uring_sqe),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+	if(sqes==MAP_FAILED)
+		return false;
+
+	unsigned char *const sq=(unsigned char*)sq_ring;
+	unsigned char *const cq=(unsigned char*)cq_ring;
+	sq_entries=params.sq_entries;
+	sq_head=(unsigned*)(sq+params.sq_off.head);
+	sq_tail=(unsigned*)(sq+params.sq_off.tail);
+	sq_mask=(unsigned*)(sq+params.sq_off.ring_mask);
+	sq_array=(unsigned*)(sq+params.sq_off.array);
+	cq_head=(unsigned*)(cq+params.cq_off.head);
+	cq_tail=(unsigned*)(cq+params.cq_off.tail);
+	cq_mask=(unsigned*)(cq+params.cq_off.ring_mask);
+	cqes=(io_uring_cqe*)(cq+params.cq_off.cqes);
+	tail=*sq_tail;
+
+	if(buffer_count>0){
+		// the kernel picks a buffer per datagram out of this ring, and they come back once they're read
+		buffer_ring=(io_uring_buf_ring*)mmap(NULL,buffer_count*sizeof(io_uring_buf),PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if(buffer_ring==MAP_FAILED)
+			return false;
+
+		io_uring_buf_reg reg;
+		memset(&reg,0,sizeof(reg));
+		reg.ring_addr=(std::uint64_t)buffer_ring;
+		reg.ring_entries=buffer_count;
+		reg.bgid=0;
+		if(syscall(__NR_io_uring_register,fd,IORING_REGISTER_PBUF_RING,&reg,1))
+			return false;
+
+		buffers.resize(buffer_count*URING_BUFFER);
+		arrived.reserve(buffer_count);
+		for(unsigned bid=0;bid<buffer_count;++bid)
+			provide(bid);
+	}
+
+	// an older kernel turns multishot down right away
+	arm();
+	if(!enter(0,0))
+		return false;
+	reap();
+	return !failed;
+}
+
+net::uring::~uring(){
+	if(fd!=-1){
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// nothing may be left writing into <buffers> or reading out of <slots> once they're freed
+		if(armed){
+			io_uring_sqe *const sqe=next();
+			if(sqe!=NULL){
+				sqe->opcode=IORING_OP_ASYNC_CANCEL;
+				sqe->addr=ARMED;
+				sqe->user_data=CANCEL;
+			}
+		}
+		const auto deadline=std::chrono::steady_clock::now()+std::chrono::milliseconds(URING_DRAIN);
+		while(!failed&&(armed||idle.size()<slots.size())&&std::chrono::steady_clock::now()<deadline){
+			enter(1,IORING_ENTER_GETEVENTS);
+			reap();
+		}
+
+		::close(fd);
+	}
+
+	if(sqes!=MAP_FAILED)
+		munmap(sqes,sq_entries*sizeof(io_uring_sqe));
+	if(cq_ring!=MAP_FAILED&&cq_ring!=sq_ring)
+		munmap(cq_ring,cq_bytes);
+	if(sq_ring!=MAP_FAILED)
+		munmap(sq_ring,sq_bytes);
+	if(buffer_ring!=(io_uring_buf_ring*)MAP_FAILED)
+		munmap(buffer_ring,buffer_count*sizeof(io_uring_buf));
+}
+
+// the kernel turned something down. whatever's queued in the socket is still there for the plain calls
+bool net::uring::broken()const{
+	return failed;
+}
+
+unsigned long long net::uring::syscalls()const{
+	return calls.load(std::memory_order_relaxed);
+}
+
+unsigned long long net::uring::failed_sends()const{
+	return lost.load(std::memory_order_relaxed);
+}
+
+// for waiter::watch. readable when there are completions
+int net::uring::descriptor()const{
+	return fd;
+}
+
+// a cleared submission queue entry, NULL if the queue is full even after submitting what's on it
+io_uring_sqe *net::uring::next(){
+	if(tail-__atomic_load_n(sq_head,__ATOMIC_ACQUIRE)>=sq_entries&&!enter(0,0))
+		return NULL;
+	if(tail-__atomic_load_n(sq_head,__ATOMIC_ACQUIRE)>=sq_entries)
+		return NULL;
+
+	const unsigned index=tail&*sq_mask;
+	io_uring_sqe *const sqe=sqes+index;
+	memset(sqe,0,sizeof(io_uring_sqe));
+	sq_array[index]=index;
+	++tail;
+	++unsubmitted;
+	__atomic_store_n(sq_tail,tail,__ATOMIC_RELEASE);
+	return sqe;
+}
+
+// one request that keeps completing, datagram after datagram (or connection after connection), until it runs
+// out of buffers or something goes wrong
+void net::uring::arm(){
+	io_uring_sqe *const sqe=next();
+	if(sqe==NULL)
+		return;
+
+	sqe->fd=sock;
+	sqe->user_data=ARMED;
+	if(kind!=mode::LISTENER){
+		sqe->opcode=IORING_OP_RECVMSG;
+		sqe->addr=(std::uint64_t)&armed_header;
+		sqe->len=1;
+		sqe->ioprio=IORING_RECV_MULTISHOT;
+		sqe->flags=IOSQE_BUFFER_SELECT;
+		sqe->buf_group=0;
+	}
+	else{
+		sqe->opcode=IORING_OP_ACCEPT;
+		sqe->ioprio=IORING_ACCEPT_MULTISHOT;
+	}
+
+	armed=true;
+}
+
+// hand buffer <bid> (back) to the kernel
+void net::uring::provide(unsigned bid){
+	// not through <bufs>: in c++ the empty struct the header pads it out with takes a byte, and it lands at offset 8
+	io_uring_buf &buf=((io_uring_buf*)buffer_ring)[buffer_tail&(buffer_count-1)];
+	buf.addr=(std::uint64_t)(buffers.data()+(std::size_t)bid*URING_BUFFER);
+	buf.len=URING_BUFFER;
+	buf.bid=bid;
+	++buffer_tail;
+	__atomic_store_n(&buffer_ring->tail,buffer_tail,__ATOMIC_RELEASE);
+}
+
+// sort out the completions. no system call
+void net::uring::reap(){
+	unsigned head=*cq_head;
+	const unsigned end=__atomic_load_n(cq_tail,__ATOMIC_ACQUIRE);
+
+	for(;head!=end;++head){
+		const io_uring_cqe &cqe=cqes[head&*cq_mask];
+
+		if(cqe.user_data==ARMED){
+			if(!(cqe.flags&IORING_CQE_F_MORE))
+				armed=false;
+
+			if(cqe.res>=0){
+				if(kind==mode::LISTENER)
+					accepted.push_back(cqe.res);
+				else if(cqe.flags&IORING_CQE_F_BUFFER)
+					arrived.push_back(cqe.flags>>IORING_CQE_BUFFER_SHIFT);
+			}
+			else if(cqe.res==-EINVAL||cqe.res==-EOPNOTSUPP||cqe.res==-EBADF)
+				failed=true; // an older kernel, no multishot
+			// -ENOBUFS: everything's waiting to be read, arm() again once it has been
+		}
+		else if(cqe.user_data<slots.size()){
+			if(cqe.res<0)
+				++lost;
+			idle.push_back(cqe.user_data);
+		}
+	}
+
+	__atomic_store_n(cq_head,head,__ATOMIC_RELEASE);
+}
+
+// submit what's queued, and wait for <wait> completions
+bool net::uring::enter(unsigned wait,unsigned flags){
+	if(unsubmitted==0&&wait==0)
+		return true;
+
+	calls.fetch_add(1,std::memory_order_relaxed);
+
+	const int result=syscall(__NR_io_uring_enter,fd,unsubmitted,wait,flags,NULL,0);
+	if(result<0){
+		// EBUSY: the completion queue overflowed, it'll go through once it's been reaped
+		if(errno!=EINTR&&errno!=EAGAIN&&errno!=EBUSY)
+			failed=true;
+		return false;
+	}
+
+	unsubmitted-=(unsigned)result<unsubmitted?result:unsubmitted;
+	return true;
+}
+
+// queue a datagram. false if it can't be, send it the plain way
+bool net::uring::send(const void *buffer,unsigned len,const sockaddr *addr,socklen_t addrlen){
+	if(len>URING_BUFFER)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(failed)
+		return false;
+
+	if(slots.empty()){
+		slots.resize(URING_SENDS);
+		idle.reserve(URING_SENDS);
+		for(unsigned i=URING_SENDS;i>0;--i)
+			idle.push_back(i-1);
+	}
+
+	// all of them in flight, wait for one
+	if(idle.empty()){
+		enter(1,IORING_ENTER_GETEVENTS);
+		reap();
+		if(idle.empty())
+			return false;
+	}
+
+	io_uring_sqe *const sqe=next();
+	if(sqe==NULL)
+		return false;
+
+	const unsigned index=idle.back();
+	idle.pop_back();
+
+	outgoing &slot=slots[index];
+	memcpy(slot.data,buffer,len);
+	memcpy(&slot.addr,addr,addrlen);
+	slot.iov.iov_base=slot.data;
+	slot.iov.iov_len=len;
+	memset(&slot.header,0,sizeof(slot.header));
+	slot.header.msg_name=&slot.addr;
+	slot.header.msg_namelen=addrlen;
+	slot.header.msg_iov=&slot.iov;
+	slot.header.msg_iovlen=1;
+
+	sqe->opcode=IORING_OP_SENDMSG;
+	sqe->fd=sock;
+	sqe->addr=(std::uint64_t)&slot.header;
+	sqe->len=1;
+	sqe->user_data=index;
+	return true;
+}
+
+// the oldest datagram that came in, same contract as recvfrom except that 0 means there isn't one
+int net::uring::recv(void *buffer,unsigned len,sockaddr_storage *addr,socklen_t *addrlen){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(next_arrived==arrived.size()){
+		arrived.clear();
+		next_arrived=0;
+		reap();
+	}
+
+	if(next_arrived==arrived.size()){
+		if(!armed&&!failed)
+			arm();
+		enter(0,0);
+		return 0;
+	}
+
+	// [io_uring_recvmsg_out][address][payload]
+	const unsigned bid=arrived[next_arrived++];
+	unsigned char *const base=buffers.data()+(std::size_t)bid*URING_BUFFER;
+	const io_uring_recvmsg_out *const out=(const io_uring_recvmsg_out*)base;
+	const unsigned char *const name=base+sizeof(io_uring_recvmsg_out);
+	const unsigned char *const payload=name+armed_header.msg_namelen+armed_header.msg_controllen;
+
+	unsigned size=out->payloadlen;
+	if(size>len)
+		size=len;
+	if(size>URING_BUFFER-(payload-base))
+		size=URING_BUFFER-(payload-base);
+	memcpy(buffer,payload,size);
+
+	const socklen_t namelen=out->namelen<sizeof(sockaddr_storage)?out->namelen:sizeof(sockaddr_storage);
+	memcpy(addr,name,namelen);
+	*addrlen=namelen;
+
+	provide(bid);
+	return size;
+}
+
+// the next connection, -1 if there isn't one
+int net::uring::accept(){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(accepted.empty())
+		reap();
+
+	if(accepted.empty()){
+		if(!armed&&!failed)
+			arm();
+		enter(0,0);
+		return -1;
+	}
+
+	const int connection=accepted.front();
+	accepted.erase(accepted.begin());
+	return connection;
+}
+
+// everything queued goes to the kernel in one go
+void net::uring::flush(){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	enter(0,0);
+}
+
+#else
+
+// nothing to build it on
+class net::uring{
+public:
+	enum class mode{SERVER,CLIENT,LISTENER};
+
+	static std::unique_ptr<uring> create(int,mode){return NULL;}
+	bool broken()const{return true;}
+	unsigned long long syscalls()const{return 0;}
+	unsigned long long failed_sends()const{return 0;}
+	int descriptor()const{return -1;}
+	bool send(const void*,unsigned,const sockaddr*,socklen_t){return false;}
+	int recv(void*,unsigned,sockaddr_storage*,socklen_t*){return 0;}
+	int accept(){return -1;}
+	void flush(){}
+};
+
+#endif // NET_IO_URING
+
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+
 net::tcp_server::tcp_server(unsigned short port){
 	bind(port);
 }
@@ -60,6 +547,13 @@ int net::tcp_server::accept(){
 	if(scan==-1)
 		return -1;
 
+	if(ring){
+		const int connection=ring->accept();
+		if(connection!=-1||!ring->broken())
+			return connection;
+		ring.reset();
+	}
+
 	sockaddr_in6 connector_addr;
 	socklen_t addr_len=sizeof(sockaddr_in6);
 	int sock=::accept(scan,(sockaddr*)&connector_addr,&addr_len);
@@ -69,6 +563,8 @@ int net::tcp_server::accept(){
 
 // cleanup
 void net::tcp_server::close(){
+	ring.reset();
+
 	if(scan != -1){
 #ifdef _WIN32
 		::closesocket(scan);
@@ -79,6 +575,11 @@ void net::tcp_server::close(){
 	}
 }
 
+// for waiter::watch
+int net::tcp_server::descriptor()const{
+	return ring?ring->descriptor():scan;
+}
+
 // creates and binds a socket
 // true on success
 // false on failure (most common cause for failure: someone else is already bound to <port>)
@@ -119,6 +620,7 @@ bool net::tcp_server::bind(unsigned short port){
 	}
 
 	listen(scan,SOMAXCONN);
+	ring=uring::create(scan,uring::mode::LISTENER);
 	return true;
 }
 
@@ -512,17 +1014,27 @@ bool net::tcp::writable(){
 // UDP
 net::udp_server::udp_server(){
 	sock = -1;
+	calls=0;
+	dropped=0;
 }
 
-net::udp_server::udp_server(unsigned short port){
+// <shared>: more sockets may bind the same port, the kernel spreads the senders over them (SO_REUSEPORT).
+// fails to bind where there's no such thing. <stream> tells the sockets' impairments apart, see impairment::from_env()
+net::udp_server::udp_server(unsigned short port,bool shared,unsigned stream){
 	sock=-1;
-	bind(port);
+	calls=0;
+	dropped=0;
+	bind(port,shared,stream);
 }
 
 // move constructor: useful for passing ownership of the internal socket
 // in a ownership handoff from <a> -> <b>, <a> cannot be used again.
 net::udp_server::udp_server(udp_server &&rhs){
 	sock=rhs.sock;
+	impaired=std::move(rhs.impaired);
+	ring=std::move(rhs.ring);
+	calls=rhs.calls.load();
+	dropped=rhs.dropped.load();
 
 	rhs.sock=-1;
 }
@@ -537,6 +1049,12 @@ net::udp_server::operator bool()const{
 
 // cleanup
 void net::udp_server::close(){
+	if(ring){
+		calls+=ring->syscalls();
+		dropped+=ring->failed_sends();
+		ring.reset();
+	}
+
 	if(sock!=-1){
 #ifdef _WIN32
 		::closesocket(sock);
@@ -552,17 +1070,26 @@ void net::udp_server::send(const void *buffer,int len,const udp_id &id){
 	if(sock==-1)
 		return;
 
+	// a bad address is that recipient's problem. the workers share the socket, it stays open
 	if(!id.initialized){
-		this->close();
+		++dropped;
 		return;
 	}
 
-	// no such thing as partial sends for sendto with udp
-	int result=sendto(sock,(const char*)buffer,len,0,(sockaddr*)&id.storage,id.len);
-	if(result!=len && get_errno() != net::WOULDBLOCK){
-		this->close();
+	if(impaired){
+		impaired->send(sock,buffer,len,(const sockaddr*)&id.storage,id.len);
 		return;
 	}
+
+	// goes out on the next flush()
+	if(ring&&ring->send(buffer,len,(const sockaddr*)&id.storage,id.len))
+		return;
+
+	// no such thing as partial sends for sendto with udp
+	++calls;
+	int result=sendto(sock,(const char*)buffer,len,0,(sockaddr*)&id.storage,id.len);
+	if(result!=len)
+		++dropped; // EHOSTUNREACH and the like, or a full send buffer
 }
 
 // non blocking recv
@@ -570,8 +1097,29 @@ int net::udp_server::recv(void *buffer,int len,udp_id &id){
 	if(sock==-1)
 		return 0;
 
+	// held back datagrams go out whenever the socket is polled
+	if(impaired)
+		impaired->flush(sock);
+
+	if(ring){
+		const int result=ring->recv(buffer,len,&id.storage,&id.len);
+		if(result>0){
+			id.initialized=true;
+			return result;
+		}
+		if(!ring->broken())
+			return 0;
+
+		// back to the plain calls
+		calls+=ring->syscalls();
+		dropped+=ring->failed_sends();
+		ring.reset();
+	}
+
 	// no partial receives
-	int result=recvfrom(sock,(char*)buffer,len,0,(sockaddr*)&id.storage,&id.len);
+	if(!impaired)
+		++calls;
+	int result=impaired?impaired->recv(sock,buffer,len,&id.storage,&id.len):recvfrom(sock,(char*)buffer,len,0,(sockaddr*)&id.storage,&id.len);
 	if(result==-1){
 		const auto eno = get_errno();
 		if(eno == net::WOULDBLOCK || eno == net::CONNRESET)
@@ -586,7 +1134,13 @@ int net::udp_server::recv(void *buffer,int len,udp_id &id){
 	return result;
 }
 
-// how many bytes are available on the socket
+// submit the sends queued on io_uring. nothing to do for the plain calls, they've gone out already
+void net::udp_server::flush(){
+	if(ring)
+		ring->flush();
+}
+
+// how many bytes are available on the socket. not counting what io_uring has already taken off it
 unsigned net::udp_server::peek(){
 	if(sock==-1)
 		return 0;
@@ -612,7 +1166,31 @@ bool net::udp_server::error()const{
 	return sock==-1;
 }
 
-bool net::udp_server::bind(unsigned short port){
+// held back datagrams only move when the socket is used, a waiter won't notice them come due
+bool net::udp_server::impaired_network()const{
+	return impaired!=NULL;
+}
+
+// for waiter::watch
+int net::udp_server::descriptor()const{
+	return ring?ring->descriptor():sock;
+}
+
+const char *net::udp_server::backend()const{
+	return ring?"io_uring":"recvfrom/sendto";
+}
+
+// since the socket was opened
+unsigned long long net::udp_server::syscalls()const{
+	return calls+(ring?ring->syscalls():0);
+}
+
+// datagrams send() couldn't get out, since the socket was opened
+unsigned long long net::udp_server::failed_sends()const{
+	return dropped+(ring?ring->failed_sends():0);
+}
+
+bool net::udp_server::bind(unsigned short port,bool shared,unsigned stream){
 	addrinfo hints,*ai;
 
 	memset(&hints,0,sizeof(addrinfo));
@@ -646,6 +1224,21 @@ bool net::udp_server::bind(unsigned short port){
 	setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(int));
 #endif // _WIN32
 
+	if(shared){
+#ifdef SO_REUSEPORT
+		int share=1;
+		if(setsockopt(sock,SOL_SOCKET,SO_REUSEPORT,(const char*)&share,sizeof(int))){
+			freeaddrinfo(ai);
+			this->close();
+			return false;
+		}
+#else
+		freeaddrinfo(ai);
+		this->close();
+		return false;
+#endif // SO_REUSEPORT
+	}
+
 	// set to non blocking
 #ifdef _WIN32
 	u_long nonblock=1;
@@ -661,6 +1254,10 @@ bool net::udp_server::bind(unsigned short port){
 
 	freeaddrinfo(ai);
 
+	impaired=impairment::from_env(stream);
+	if(!impaired)
+		ring=uring::create(sock,uring::mode::SERVER);
+
 	return true;
 }
 
@@ -687,6 +1284,8 @@ net::udp::udp(const std::string &address,unsigned short port){
 net::udp::udp(udp &&rhs){
 	sock=rhs.sock;
 	ai=rhs.ai;
+	impaired=std::move(rhs.impaired);
+	ring=std::move(rhs.ring);
 
 	rhs.sock=-1;
 	rhs.ai=NULL;
@@ -701,6 +1300,8 @@ net::udp &net::udp::operator=(net::udp &&other){
 
 	sock=other.sock;
 	ai=other.ai;
+	impaired=std::move(other.impaired);
+	ring=std::move(other.ring);
 
 	other.sock=-1;
 	other.ai=NULL;
@@ -716,6 +1317,11 @@ void net::udp::send(const void *buffer,unsigned len){
 	if(sock==-1)
 		return;
 
+	if(impaired){
+		impaired->send(sock,buffer,len,ai->ai_addr,ai->ai_addrlen);
+		return;
+	}
+
 	// no such thing as a partial send for udp with sendto
 	const ssize_t result=sendto(sock,(const char*)buffer,len,0,(sockaddr*)ai->ai_addr,ai->ai_addrlen);
 	if((unsigned)result!=len && get_errno() != net::WOULDBLOCK){
@@ -732,8 +1338,19 @@ int net::udp::recv(void *buffer,unsigned len){
 	sockaddr_storage src_addr;
 	socklen_t src_len=sizeof(sockaddr_storage);
 
+	// held back datagrams go out whenever the socket is polled
+	if(impaired)
+		impaired->flush(sock);
+
+	if(ring){
+		const int result=ring->recv(buffer,len,&src_addr,&src_len);
+		if(result>0||!ring->broken())
+			return result;
+		ring.reset();
+	}
+
 	// no such thing as a partial send for udp with sendto
-	const ssize_t result=recvfrom(sock,(char*)buffer,len,0,(sockaddr*)&src_addr,&src_len);
+	const ssize_t result=impaired?impaired->recv(sock,buffer,len,&src_addr,&src_len):recvfrom(sock,(char*)buffer,len,0,(sockaddr*)&src_addr,&src_len);
 	if(result==-1){
 		const auto eno = get_errno();
 		if(eno == net::WOULDBLOCK || eno == net::CONNRESET)
@@ -770,7 +1387,18 @@ bool net::udp::error()const{
 	return sock==-1;
 }
 
+bool net::udp::impaired_network()const{
+	return impaired!=NULL;
+}
+
+// for waiter::watch
+int net::udp::descriptor()const{
+	return ring?ring->descriptor():sock;
+}
+
 void net::udp::close(){
+	ring.reset();
+
 	if(sock!=-1){
 #ifdef _WIN32
 		::closesocket(sock);
@@ -817,5 +1445,266 @@ bool net::udp::target(const std::string &address,unsigned short port){
 	fcntl(sock,F_SETFL,fcntl(sock,F_GETFL,0)|O_NONBLOCK); // set to non blocking
 #endif // _WIN32
 
+	// only the receiving end, a client sends a datagram or two a frame and there's nothing to batch
+	impaired=impairment::from_env();
+	if(!impaired)
+		ring=uring::create(sock,uring::mode::CLIENT);
+
 	return true;
 }
+
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+
+// network impairment
+#define IMPAIRMENT_BACKLOG 1000 // milliseconds of datagrams the rate cap will queue before it drops
+
+net::impairment::impairment(const settings &s)
+	:cfg(s),out(s.seed),in(s.seed^0x9e3779b9){}
+
+// from STBSRISRATES_NETSIM, comma separated. e.g.
+// STBSRISRATES_NETSIM=latency=80,jitter=20,loss=0.05,duplicate=0.01,reorder=0.02,rate=16000,seed=7,inbound=1
+// NULL if it isn't set.
+// <stream> is mixed into the seed, so sockets sharing a port (which each get one) don't all drop the same datagrams
+std::unique_ptr<net::impairment> net::impairment::from_env(unsigned stream){
+	const char *const env=getenv("STBSRISRATES_NETSIM");
+	if(env==NULL||env[0]==0)
+		return NULL;
+
+	settings s;
+	const char *pos=env;
+	while(*pos){
+		char key[32];
+		double value;
+		int consumed=0;
+		if(sscanf(pos,"%31[^=,]=%lf%n",key,&value,&consumed)!=2){
+			fprintf(stderr,"STBSRISRATES_NETSIM: can't make sense of \"%s\"\n",pos);
+			return NULL;
+		}
+
+		if(!strcmp(key,"latency")) s.latency=value;
+		else if(!strcmp(key,"jitter")) s.jitter=value;
+		else if(!strcmp(key,"loss")) s.loss=value;
+		else if(!strcmp(key,"duplicate")) s.duplicate=value;
+		else if(!strcmp(key,"reorder")) s.reorder=value;
+		else if(!strcmp(key,"rate")) s.rate=value;
+		else if(!strcmp(key,"seed")) s.seed=value;
+		else if(!strcmp(key,"inbound")) s.inbound=value!=0.0;
+		else{
+			fprintf(stderr,"STBSRISRATES_NETSIM: unknown setting \"%s\"\n",key);
+			return NULL;
+		}
+
+		pos+=consumed;
+		if(*pos==',')
+			++pos;
+	}
+
+	s.seed^=stream*0x9e3779b9u;
+
+	fprintf(stderr,"[impaired network: latency %dms, jitter %dms, loss %.3f, duplicate %.3f, reorder %.3f, rate %d bytes/sec, seed %u%s]\n",
+		s.latency,s.jitter,s.loss,s.duplicate,s.reorder,s.rate,s.seed,s.inbound?", both ways":"");
+
+	return std::unique_ptr<impairment>(new impairment(s));
+}
+
+const net::impairment::settings &net::impairment::config()const{
+	return cfg;
+}
+
+// hold an outgoing datagram back
+void net::impairment::send(int sock,const void *buffer,unsigned len,const sockaddr *addr,socklen_t addrlen){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	out.admit(buffer,len,addr,addrlen,cfg);
+	flush_locked(sock);
+}
+
+// send whatever is due
+void net::impairment::flush(int sock){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	flush_locked(sock);
+}
+
+void net::impairment::flush_locked(int sock){
+	datagram dgram;
+	while(out.due(dgram))
+		sendto(sock,(const char*)dgram.data.data(),dgram.data.size(),0,(const sockaddr*)&dgram.addr,dgram.len);
+}
+
+// same contract as recvfrom, except it returns 0 when nothing is due
+int net::impairment::recv(int sock,void *buffer,unsigned len,sockaddr_storage *addr,socklen_t *addrlen){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(cfg.inbound){
+		// pull everything off the socket and into the line
+		unsigned char scratch[65536];
+		for(;;){
+			sockaddr_storage from;
+			socklen_t fromlen=sizeof(from);
+			const int result=recvfrom(sock,(char*)scratch,sizeof(scratch),0,(sockaddr*)&from,&fromlen);
+			if(result==-1){
+				const int eno=get_errno();
+				if(eno==net::WOULDBLOCK||eno==net::CONNRESET)
+					break;
+				return -1;
+			}
+
+			in.admit(scratch,result,(const sockaddr*)&from,fromlen,cfg);
+		}
+
+		datagram dgram;
+		if(!in.due(dgram))
+			return 0;
+
+		const unsigned size=dgram.data.size()<len?dgram.data.size():len;
+		memcpy(buffer,dgram.data.data(),size);
+		memcpy(addr,&dgram.addr,dgram.len);
+		*addrlen=dgram.len;
+
+		return size;
+	}
+
+	return recvfrom(sock,(char*)buffer,len,0,(sockaddr*)addr,addrlen);
+}
+
+net::impairment::line::line(unsigned seed)
+	:random(seed){}
+
+// decide what happens to a datagram, and when
+void net::impairment::line::admit(const void *buffer,unsigned len,const sockaddr *addr,socklen_t addrlen,const settings &cfg){
+	std::uniform_real_distribution<double> chance(0.0,1.0);
+
+	if(chance(random)<cfg.loss)
+		return;
+
+	const clock::time_point now=clock::now();
+
+	// the rate cap serializes datagrams onto the line, and drops them when too many are waiting
+	if(cfg.rate>0){
+		if(busy<now)
+			busy=now;
+		if(busy-now>std::chrono::milliseconds(IMPAIRMENT_BACKLOG))
+			return;
+		busy+=std::chrono::microseconds((len*1000000ll)/cfg.rate);
+	}
+
+	const int copies=chance(random)<cfg.duplicate?2:1;
+	for(int i=0;i<copies;++i){
+		std::uniform_int_distribution<int> jitter(-cfg.jitter,cfg.jitter);
+		const int delay=cfg.latency+jitter(random);
+
+		datagram dgram;
+		dgram.due=(cfg.rate>0?busy:now)+std::chrono::milliseconds(delay>0?delay:0);
+		dgram.data.assign((const unsigned char*)buffer,(const unsigned char*)buffer+len);
+		memset(&dgram.addr,0,sizeof(dgram.addr));
+		memcpy(&dgram.addr,addr,addrlen);
+		dgram.len=addrlen;
+
+		// jitter alone keeps the order, a reordered datagram is held back past the ones behind it
+		if(chance(random)<cfg.reorder){
+			std::uniform_int_distribution<int> hold(1,cfg.jitter*2+20);
+			dgram.due=(dgram.due>last?dgram.due:last)+std::chrono::milliseconds(hold(random));
+		}
+		else{
+			if(dgram.due<last)
+				dgram.due=last;
+			last=dgram.due;
+		}
+
+		// stable, so datagrams due at the same time keep their order
+		auto it=queue.end();
+		while(it!=queue.begin()&&(it-1)->due>dgram.due)
+			--it;
+		queue.insert(it,std::move(dgram));
+	}
+}
+
+// pop the next datagram that's due
+bool net::impairment::line::due(datagram &dgram){
+	if(queue.empty()||queue.front().due>clock::now())
+		return false;
+
+	dgram=std::move(queue.front());
+	queue.erase(queue.begin());
+
+	return true;
+}
+
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+/* ------------------------------------------- */
+
+// WAITER
+net::waiter::waiter(){
+#ifdef __linux__
+	event=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+#else
+	event=-1;
+#endif // __linux__
+}
+
+net::waiter::~waiter(){
+#ifndef _WIN32
+	if(event!=-1)
+		::close(event);
+#endif // _WIN32
+}
+
+void net::waiter::watch(int sock){
+	if(sock!=-1)
+		socks.push_back(sock);
+}
+
+// <timeout> in milliseconds, -1 for none
+// returns true if a socket is readable or it was woken, false on timeout
+bool net::waiter::wait(int timeout){
+	if(event==-1&&(timeout<0||timeout>WAITER_FALLBACK))
+		timeout=WAITER_FALLBACK;
+
+#ifdef _WIN32
+	fd_set readable;
+	FD_ZERO(&readable);
+	for(const int sock:socks)
+		FD_SET(sock,&readable);
+
+	timeval tv;
+	tv.tv_sec=timeout/1000;
+	tv.tv_usec=(timeout%1000)*1000;
+
+	return select(0,&readable,NULL,NULL,&tv)>0;
+#else
+	std::vector<pollfd> fds;
+	for(const int sock:socks)
+		fds.push_back({sock,POLLIN,0});
+	if(event!=-1)
+		fds.push_back({event,POLLIN,0});
+
+	if(poll(fds.data(),fds.size(),timeout)<=0)
+		return false;
+
+	// reset the wake up. if that fails the next wait just returns early
+	if(event!=-1&&(fds.back().revents&POLLIN)){
+		std::uint64_t count;
+		const ssize_t drained=read(event,&count,sizeof(count));
+		(void)drained;
+	}
+
+	return true;
+#endif // _WIN32
+}
+
+// cut a wait() short
+void net::waiter::wake(){
+#ifndef _WIN32
+	if(event!=-1){
+		const std::uint64_t one=1;
+		const ssize_t written=write(event,&one,sizeof(one));
+		(void)written;
+	}
+#endif // _WIN32
+}
@@ -2,6 +2,12 @@
 #define NETWORK_H
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <chrono>
 #include <string.h>
 #ifdef _WIN32
 #undef _WIN32_WINNT
@@ -25,6 +31,8 @@ namespace net{
 	const int CONNRESET = ECONNRESET;
 #endif // _WIN32
 
+class uring; // io_uring backend, see network.cpp
+
 // tcp
 class tcp_server{
 public:
@@ -37,9 +45,11 @@ public:
 	bool bind(unsigned short);
 	int accept();
 	void close();
+	int descriptor()const;
 
 private:
 	int scan; // the socket for scanning
+	std::unique_ptr<uring> ring; // multishot accept on <scan>, NULL for plain accept()
 };
 
 class tcp{
@@ -77,12 +87,69 @@ private:
 	bool blocking;
 };
 
+// fake bad network, for testing. sits under udp and udp_server and holds datagrams back, drops,
+// duplicates and reorders them, and caps the rate. every decision comes from a seeded prng
+class impairment{
+public:
+	struct settings{
+		settings():latency(0),jitter(0),loss(0.0),duplicate(0.0),reorder(0.0),rate(0),seed(1),inbound(false){}
+
+		int latency; // milliseconds, one way
+		int jitter; // milliseconds either side of <latency>
+		double loss,duplicate,reorder; // chance per datagram
+		int rate; // bytes per second, 0 for no cap
+		unsigned seed;
+		bool inbound; // impair what comes in too, not just what goes out
+	};
+
+	impairment(const settings&);
+	impairment(const impairment&)=delete;
+	impairment &operator=(const impairment&)=delete;
+	static std::unique_ptr<impairment> from_env(unsigned=0);
+	const settings &config()const;
+	void send(int,const void*,unsigned,const sockaddr*,socklen_t);
+	void flush(int);
+	int recv(int,void*,unsigned,sockaddr_storage*,socklen_t*);
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	void flush_locked(int);
+
+	struct datagram{
+		clock::time_point due;
+		std::vector<unsigned char> data;
+		sockaddr_storage addr;
+		socklen_t len;
+	};
+
+	// one direction
+	struct line{
+		line(unsigned);
+		void admit(const void*,unsigned,const sockaddr*,socklen_t,const settings&);
+		bool due(datagram&);
+
+		std::mt19937 random;
+		std::vector<datagram> queue; // by due time
+		clock::time_point busy; // the rate cap has the line busy until then
+		clock::time_point last; // due time of the last datagram that wasn't reordered
+	};
+
+	const settings cfg;
+	std::mutex mutex;
+	line out,in;
+};
+
 // udp
 struct udp_id{
 	udp_id():initialized(false),len(sizeof(sockaddr_storage)){
 		memset(&storage, 0, sizeof(storage));
 	}
 
+	bool operator==(const udp_id &rhs)const{
+		return len==rhs.len&&memcmp(&storage,&rhs.storage,len)==0;
+	}
+
 	bool initialized;
 	sockaddr_storage storage;
 	socklen_t len;
@@ -91,7 +158,7 @@ struct udp_id{
 class udp_server{
 public:
 	udp_server();
-	udp_server(unsigned short);
+	udp_server(unsigned short,bool=false,unsigned=0);
 	udp_server(const udp_server&)=delete;
 	udp_server(udp_server&&);
 	~udp_server();
@@ -100,13 +167,23 @@ public:
 	void close();
 	void send(const void*,int,const udp_id&);
 	int recv(void*,int,udp_id&);
+	void flush();
 	unsigned peek();
 	bool error()const;
+	bool impaired_network()const;
+	int descriptor()const;
+	const char *backend()const;
+	unsigned long long syscalls()const;
+	unsigned long long failed_sends()const;
 
 private:
-	bool bind(unsigned short);
+	bool bind(unsigned short,bool,unsigned);
 
 	int sock;
+	std::unique_ptr<impairment> impaired; // NULL on a good network
+	std::unique_ptr<uring> ring; // NULL for plain recvfrom/sendto
+	std::atomic<unsigned long long> calls; // system calls made on the socket's behalf, for the server's report
+	std::atomic<unsigned long long> dropped; // sends that failed, counted rather than closing a socket the workers share
 };
 
 class udp{
@@ -125,10 +202,33 @@ public:
 	int recv(void*,unsigned);
 	unsigned peek();
 	bool error()const;
+	bool impaired_network()const;
+	int descriptor()const;
 
 private:
 	int sock;
 	addrinfo *ai;
+	std::unique_ptr<impairment> impaired; // NULL on a good network
+	std::unique_ptr<uring> ring; // receives only, NULL for plain recvfrom
+};
+
+#define WAITER_FALLBACK 100 // milliseconds a wait lasts at most where wake() can't cut it short
+
+// blocks until one of the watched sockets has something to read, somebody calls wake() (from any thread)
+// or the timeout runs out. lets a server with nothing to do sleep instead of polling
+class waiter{
+public:
+	waiter();
+	waiter(const waiter&)=delete;
+	~waiter();
+	waiter &operator=(const waiter&)=delete;
+	void watch(int);
+	bool wait(int);
+	void wake();
+
+private:
+	std::vector<int> socks;
+	int event; // eventfd, -1 where there isn't one
 };
 
 } // namespace socket
@@ -4,24 +4,23 @@
 #define SERVER_PORT 28881
 
 #include <random>
+#include <chrono>
+#include <cstdint>
 
 #include <time.h>
 
 #include "Log.h"
 
 #define MAX_PLAYERS 2
-#define MAX_ASTEROIDS 36
+#define MAX_ASTEROIDS 36 // asteroid budget per sector (see GameState.h)
 #define MAX_DATAGRAM_SIZE 700
+#define INPUT_HISTORY 6 // input frames repeated in each ClientInfo
+#define LOCKSTEP_TICKS 32 // most steps of inputs in one Lockstep lump
+#define LOCKSTEP_CHECKSUM 30 // steps between lockstep state checksums
+#define SNAPSHOT_CHECKSUM 30 // steps at least between snapshot checksums
 
-#define CLIENT_TIMEOUT 4
-#define SERVER_TIMEOUT 10
-
-#define WORLD_LEFT -400
-#define WORLD_WIDTH 1000
-#define WORLD_TOP -400
-#define WORLD_HEIGHT 1000
-#define WORLD_RIGHT (WORLD_LEFT + WORLD_WIDTH)
-#define WORLD_BOTTOM (WORLD_TOP + WORLD_HEIGHT)
+#define CLIENT_TIMEOUT 4000 // milliseconds
+#define SERVER_TIMEOUT 10000
 
 #define hcf(fmt, ...) {lprintf("\033[35;1mFatal Error:\033[0m " fmt, ##__VA_ARGS__);std::abort();}
 
@@ -53,6 +52,56 @@ private:
 	std::mt19937 generator;
 };
 
+// counter based prng: the numbers only depend on what it's keyed with, not on what was drawn before or on which
+// thread. the server keys one per entity per step, so the simulation comes out the same however it's split up
+class splitmix
+{
+public:
+	splitmix(std::uint64_t seed, std::uint32_t step, std::int32_t id, std::uint32_t stream)
+		: state(mix(mix(mix(seed ^ step) ^ std::uint32_t(id)) ^ stream))
+		, counter(0) {}
+
+	int operator()(int low, int high)
+	{
+		return low + int(next() % (std::uint64_t(std::int64_t(high) - low) + 1));
+	}
+
+	float operator()(double low, double high)
+	{
+		return low + ((next() >> 11) * (1.0 / 9007199254740992.0) * (high - low));
+	}
+
+	bool operator()(int onein)
+	{
+		if(onein == 0)
+			return false;
+
+		return this->operator()(0, onein - 1) == 0;
+	}
+
+private:
+	std::uint64_t next()
+	{
+		return mix(state + (++counter * 0x9e3779b97f4a7c15ull));
+	}
+
+	static std::uint64_t mix(std::uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	const std::uint64_t state;
+	std::uint64_t counter;
+};
+
+// on a clock that never jumps, for timeouts and round trips. wall time is for reports and cookies
+inline std::int64_t milliseconds()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 inline void targetf(float *const subject, float step, float target)
 {
 	if(*subject > target)
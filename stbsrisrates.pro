@@ -1,25 +1,41 @@
 HEADERS += stbsrisrates.h
 HEADERS += Dialog.h
 HEADERS += Server.h
+HEADERS += Broadcast.h
 HEADERS += network.h
 HEADERS += GameState.h
 HEADERS += Lump.h
+HEADERS += Snapshot.h
+HEADERS += Simulation.h
+HEADERS += Workers.h
+HEADERS += InputQueue.h
+HEADERS += ClockSync.h
 HEADERS += Log.h
 HEADERS += Window.h
+HEADERS += Assets.h
+HEADERS += Mixer.h
 HEADERS += Asteroids.h
 
 SOURCES += main.cpp
 SOURCES += Dialog.cpp
 SOURCES += Server.cpp
+SOURCES += Broadcast.cpp
 SOURCES += network.cpp
 SOURCES += GameState.cpp
+SOURCES += Snapshot.cpp
+SOURCES += Simulation.cpp
+SOURCES += Workers.cpp
+SOURCES += InputQueue.cpp
+SOURCES += ClockSync.cpp
 SOURCES += Log.cpp
 SOURCES += Window.cpp
+SOURCES += Assets.cpp
+SOURCES += Mixer.cpp
 SOURCES += Asteroids.cpp
 
 CONFIG += debug console
 
-QMAKE_CXXFLAGS += -std=c++17
+QMAKE_CXXFLAGS += -std=c++17 -ffp-contract=off # lockstep clients have to round exactly like the server
 
 QT += widgets gamepad multimedia
 